@@ -3,6 +3,8 @@
  */
 
 #include "LC4.h"
+#include "events.h"
+#include "system.h"
 #include <stdio.h>
 
 /*
@@ -12,12 +14,8 @@ void Reset(MachineState* CPU)
 {
     CPU->PSR = 0x8002;
     CPU->PC = 0x8200;
-    for (int i = 0; i < sizeof(CPU->memory); i++) {
-        CPU->memory[i] = 0;
-    }
-    for(int i = 0; i < sizeof(CPU->R);i++) {
-        CPU->R[i] = 0;
-    }
+    memset(CPU->memory, 0, 65536 * sizeof(unsigned short int));
+    memset(CPU->R, 0, sizeof(CPU->R));
     ClearSignals(CPU);
 }
 
@@ -83,9 +81,13 @@ int UpdateMachineState(MachineState* CPU, FILE* output)
     int address_issue = CheckPermissions(CPU, CPU->PC);
     if(address_issue == 1) {
         ClearSignals(CPU);
-        printf("error: address out of permitted range\n");
+        if (!CPU->quiet) {
+            printf("error: address out of permitted range\n");
+        }
         return 1;
     }
+    //clears the signals left by the previous instruction, they stay readable until the next cycle
+    ClearSignals(CPU);
     //saves the PC to be printed out later
     unsigned short int curr_pc = CPU->PC;
     unsigned short int opcode = CPU->memory[CPU->PC] >> 12u;
@@ -152,9 +154,15 @@ int UpdateMachineState(MachineState* CPU, FILE* output)
         ConstOp(CPU, output);
     }
     else {
-        printf("error: unrecognised instruction in program memory\n");
+        if (!CPU->quiet) {
+            printf("error: unrecognised instruction in program memory\n");
+        }
         return 1;
     }
+    //untraced runs skip all of the formatting
+    if (output == NULL) {
+        return 0;
+    }
     //prints the PC and calls Writeout
     fprintf(output, "%04X", curr_pc);
     fprintf(output, " ");
@@ -169,8 +177,6 @@ int UpdateMachineState(MachineState* CPU, FILE* output)
     }
     fprintf(output, " ");
     WriteOut(CPU, output);
-    //clears necessary spots in the machine before the next run of the program
-    ClearSignals(CPU);
     return 0;
 }
 
@@ -244,6 +250,10 @@ void ArithmeticOp(MachineState* CPU, FILE* output)
         else if(subop == 2) {
             CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] - CPU->R[CPU->rtMux_CTL];
         }
+        //dividing by zero gives zero, as in PennSim
+        else if(subop == 3 && CPU->R[CPU->rtMux_CTL] == 0) {
+            CPU->R[CPU->rdMux_CTL] = 0;
+        }
         else if(subop == 3) {
             CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] / CPU->R[CPU->rtMux_CTL];
         }
@@ -294,7 +304,7 @@ void ComparativeOp(MachineState* CPU, FILE* output)
         SetNZP(CPU, CPU->R[CPU->rsMux_CTL] - imm7);
     }
     else if(subop == 3) {
-        unsigned short int nzp;
+        unsigned short int nzp = 0;
         unsigned short int uimm7 = CPU->memory[CPU->PC] & 0x007F;
         if (CPU->R[CPU->rsMux_CTL] < uimm7) {
             nzp = nzp + 4;
@@ -413,7 +423,12 @@ void ShiftModOp(MachineState* CPU, FILE* output)
     }
     else if (subop == 3) {
         CPU->rtMux_CTL = uimm4 & 0x0007;
-        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] % CPU->R[CPU->rtMux_CTL];
+        if (CPU->R[CPU->rtMux_CTL] == 0) {
+            CPU->R[CPU->rdMux_CTL] = 0;
+        }
+        else {
+            CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] % CPU->R[CPU->rtMux_CTL];
+        }
     }
     SetNZP(CPU, CPU->R[CPU->rdMux_CTL]);
     CPU->PC = CPU->PC + 1;  
@@ -430,8 +445,20 @@ int LoadOp(MachineState* CPU, FILE* output) {
     }
     CPU->rdMux_CTL = (CPU->memory[CPU->PC] >> 9u) & 0x0007;
     CPU->dmemAddr = CPU->R[CPU->rsMux_CTL] + imm6;
-    CPU->dmemValue = CPU->memory[CPU->R[CPU->rsMux_CTL] + imm6];
-    CPU->R[CPU->rdMux_CTL] = CPU->memory[CPU->R[CPU->rsMux_CTL] + imm6];
+    if (CPU->system == NULL) {
+        CPU->dmemValue = CPU->memory[CPU->dmemAddr];
+    }
+    else if (EVENT_TEST(CPU->system->atomicMap, CPU->dmemAddr)) {
+        CPU->dmemValue = AtomicLoad(CPU->system, CPU->dmemAddr);
+    }
+    else {
+        //other cores may be storing to the word at the same time
+        CPU->dmemValue = __atomic_load_n(&CPU->memory[CPU->dmemAddr], __ATOMIC_RELAXED);
+    }
+    if (CPU->events != NULL && EVENT_TEST(CPU->events->readMap, CPU->dmemAddr)) {
+        WatchHit(CPU->events, STOP_READ_WATCH, CPU->dmemAddr);
+    }
+    CPU->R[CPU->rdMux_CTL] = CPU->dmemValue;
     SetNZP(CPU, CPU->R[CPU->rdMux_CTL]);
     CPU->PC = CPU->PC + 1;
     return 0;
@@ -448,8 +475,19 @@ int StoreOp(MachineState* CPU, FILE* output) {
     }
     CPU->rtMux_CTL = (CPU->memory[CPU->PC] >> 9u) & 0x0007;
     CPU->dmemAddr = CPU->R[CPU->rsMux_CTL] + imm6;
-    CPU->memory[CPU->R[CPU->rsMux_CTL] + imm6] = CPU->R[CPU->rtMux_CTL];
     CPU->dmemValue = CPU->R[CPU->rtMux_CTL];
+    if (CPU->system == NULL) {
+        CPU->memory[CPU->dmemAddr] = CPU->dmemValue;
+    }
+    else if (EVENT_TEST(CPU->system->atomicMap, CPU->dmemAddr)) {
+        AtomicStore(CPU->system, CPU->dmemAddr, CPU->dmemValue);
+    }
+    else {
+        __atomic_store_n(&CPU->memory[CPU->dmemAddr], CPU->dmemValue, __ATOMIC_RELAXED);
+    }
+    if (CPU->events != NULL && EVENT_TEST(CPU->events->writeMap, CPU->dmemAddr)) {
+        WatchHit(CPU->events, STOP_WRITE_WATCH, CPU->dmemAddr);
+    }
     CPU->PC = CPU->PC + 1;
     return 0;
 }
@@ -546,10 +584,96 @@ unsigned short int extend_imm11(unsigned short int result) {
 }
 
 
+/*
+ * Writes the assembly for instruction into buffer, which must hold at least 32 characters.
+ */
+void Disassemble(unsigned short int instruction, char* buffer)
+{
+    static const char* arith[4] = {"ADD", "MUL", "SUB", "DIV"};
+    static const char* logic[4] = {"AND", "NOT", "OR", "XOR"};
+    static const char* compare[4] = {"CMP", "CMPU", "CMPI", "CMPIU"};
+    static const char* shift[4] = {"SLL", "SRA", "SRL", "MOD"};
+    static const char* nzp[8] = {"NOP", "BRp", "BRz", "BRzp", "BRn", "BRnp", "BRnz", "BRnzp"};
+    unsigned short int opcode = instruction >> 12u;
+    unsigned short int rd = (instruction >> 9u) & 0x0007;
+    unsigned short int rs = (instruction >> 6u) & 0x0007;
+    unsigned short int rt = instruction & 0x0007;
+    unsigned short int subop = (instruction >> 3u) & 0x0007;
+    if (opcode == 0) {
+        if (rd == 0) {
+            sprintf(buffer, "NOP");
+        }
+        else {
+            sprintf(buffer, "%s #%d", nzp[rd], (short) extend_imm9(instruction & 0x01FF));
+        }
+    }
+    else if (opcode == 1 || opcode == 5) {
+        const char** names = (opcode == 1) ? arith : logic;
+        if (subop >= 4) {
+            sprintf(buffer, "%s R%d, R%d, #%d", names[0], rd, rs, (short) extend_imm5(instruction & 0x001F));
+        }
+        else if (opcode == 5 && subop == 1) {
+            sprintf(buffer, "NOT R%d, R%d", rd, rs);
+        }
+        else {
+            sprintf(buffer, "%s R%d, R%d, R%d", names[subop], rd, rs, rt);
+        }
+    }
+    else if (opcode == 2) {
+        subop = (instruction >> 7u) & 0x0003;
+        if (subop < 2) {
+            sprintf(buffer, "%s R%d, R%d", compare[subop], rd, rt);
+        }
+        else if (subop == 2) {
+            sprintf(buffer, "CMPI R%d, #%d", rd, (short) extend_imm7(instruction & 0x007F));
+        }
+        else {
+            sprintf(buffer, "CMPIU R%d, #%d", rd, instruction & 0x007F);
+        }
+    }
+    else if (opcode == 4 || opcode == 12) {
+        if (instruction & 0x0800) {
+            sprintf(buffer, "%s #%d", (opcode == 4) ? "JSR" : "JMP", (short) extend_imm11(instruction & 0x07FF));
+        }
+        else {
+            sprintf(buffer, "%s R%d", (opcode == 4) ? "JSRR" : "JMPR", rs);
+        }
+    }
+    else if (opcode == 6 || opcode == 7) {
+        sprintf(buffer, "%s R%d, R%d, #%d", (opcode == 6) ? "LDR" : "STR", rd, rs, (short) extend_imm6(instruction & 0x003F));
+    }
+    else if (opcode == 8) {
+        sprintf(buffer, "RTI");
+    }
+    else if (opcode == 9) {
+        sprintf(buffer, "CONST R%d, #%d", rd, (short) extend_imm9(instruction & 0x01FF));
+    }
+    else if (opcode == 10) {
+        subop = (instruction >> 4u) & 0x0003;
+        if (subop == 3) {
+            sprintf(buffer, "MOD R%d, R%d, R%d", rd, rs, rt);
+        }
+        else {
+            sprintf(buffer, "%s R%d, R%d, #%d", shift[subop], rd, rs, instruction & 0x000F);
+        }
+    }
+    else if (opcode == 13) {
+        sprintf(buffer, "HICONST R%d, #%d", rd, instruction & 0x00FF);
+    }
+    else if (opcode == 15) {
+        sprintf(buffer, "TRAP x%02X", instruction & 0x00FF);
+    }
+    else {
+        sprintf(buffer, "illegal x%04X", instruction);
+    }
+}
+
+
 //checks to see if the provided address is in the range of the system
 int CheckPermissions(MachineState* CPU, unsigned short int address) {
     unsigned short int psr15 = CPU->PSR >> 15u;
-    if (psr15 == 0 && address > 0x7FFF && address < 0xFFFF) {
+    //user mode may not touch any of x8000-xFFFF, device registers at the top included
+    if (psr15 == 0 && address > 0x7FFF) {
         return 1;
     }
     if (psr15 == 1 && address < 0x8000 && address >= 0x0000) {
@@ -2,10 +2,19 @@
  * LC4.h: Declares simulator functions for executing instructions
  */
 
+#ifndef LC4_H
+#define LC4_H
+
 #include "string.h"
 #include <stdio.h>
 #include <stdlib.h>
 
+// Stop conditions, breakpoints and watchpoints - see events.h
+typedef struct EventState EventState;
+
+// Cores sharing one memory - see system.h
+typedef struct SystemState SystemState;
+
 typedef struct {
     // PC the current value of the Program Counter register
     unsigned short int PC;
@@ -33,13 +42,25 @@ typedef struct {
     unsigned short int dmemAddr;
     unsigned short int dmemValue;
 
-    // Machine memory - all of it
-    unsigned short int memory[65536];
+    // Data watchpoints checked by LoadOp and StoreOp, NULL when none are armed
+    EventState* events;
+
+    // The system the core shares memory with, NULL on a single core; LoadOp and StoreOp go
+    // through it for every data access
+    SystemState* system;
+
+    // Set to keep UpdateMachineState from printing errors, for callers that classify them
+    unsigned char quiet;
+
+    // Machine memory - all 65536 words of it, shared by the cores of a system
+    unsigned short int* memory;
 } MachineState;
 
 
 /*
  * This function should execute one LC4 datapath cycle.
+ * The trace line is skipped when output is NULL. The control signals describe the
+ * executed instruction until the next call.
  */
 int UpdateMachineState(MachineState* CPU, FILE* output);
 
@@ -123,6 +144,11 @@ void HiconstOp(MachineState* CPU, FILE* output);
 
 int CheckPermissions(MachineState* CPU, unsigned short int address);
 
+/*
+ * Writes the assembly for instruction into buffer, which must hold at least 32 characters.
+ */
+void Disassemble(unsigned short int instruction, char* buffer);
+
 
 unsigned short int extend_imm9(unsigned short int result);
 
@@ -133,3 +159,5 @@ unsigned short int extend_imm7(unsigned short int result);
 unsigned short int extend_imm6(unsigned short int result);
 
 unsigned short int extend_imm11(unsigned short int result);
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * cosim.c: location of main() for the co-simulation checker
+ *
+ * Runs the same program on a reference engine and a fast engine side by side and reports
+ * the first instruction where PC, PSR, the registers or a store differ. For the first
+ * -warmup cycles every instruction is compared in full. After that only stores are folded
+ * into a running hash per engine, and the states are compared every -period cycles. When a
+ * period fails both engines are replayed from the last good checkpoint with full compares
+ * to find the exact instruction.
+ */
+
+#include "loader.h"
+#include "events.h"
+
+// Default number of fully compared cycles at the start of a run
+#define DEFAULT_WARMUP 10000
+
+// Default number of cycles between hash compares after the warmup
+#define DEFAULT_PERIOD 65536
+
+// Number of instructions printed before a divergence
+#define HISTORY_SIZE 8
+
+// The machine is done when it reaches this PC, as in trace
+#define HALT_PC 0x80FF
+
+typedef struct {
+    const char* name;
+    // executes one instruction, returns nonzero on an error
+    int (*step)(MachineState* CPU);
+} Engine;
+
+typedef struct {
+    unsigned short int PC;
+    unsigned short int instruction;
+} HistoryEntry;
+
+// Trace output of the reference engine is formatted, then thrown away
+FILE* null_output;
+
+int StepReference(MachineState* CPU)
+{
+    return UpdateMachineState(CPU, null_output);
+}
+
+int StepUntraced(MachineState* CPU)
+{
+    return UpdateMachineState(CPU, NULL);
+}
+
+// Engines that can be selected with -ref and -test, new engines are added here
+Engine engines[] = {
+    {"reference", StepReference},
+    {"untraced", StepUntraced},
+};
+
+MachineState ref;
+MachineState test;
+MachineState checkpoint;
+MachineState previous;
+unsigned short int ref_memory[65536];
+unsigned short int test_memory[65536];
+unsigned short int checkpoint_memory[65536];
+unsigned short int previous_memory[65536];
+
+// Cycles the checkpoint and the one before it were taken at, a replay starts from the older
+// one so the instructions leading up to a divergence are always there to print
+unsigned long long checkpoint_cycle = 0;
+unsigned long long previous_cycle = 0;
+
+HistoryEntry history[HISTORY_SIZE];
+
+Engine* FindEngine(char* name)
+{
+    for (int i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0) {
+            return &engines[i];
+        }
+    }
+    printf("error: unknown engine %s\n", name);
+    return NULL;
+}
+
+/*
+ * Returns the name of the first of error status, PC, PSR and the registers that differs,
+ * or NULL if they agree.
+ */
+const char* CompareRegisters(MachineState* a, int statusA, MachineState* b, int statusB)
+{
+    static const char* registers[8] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7"};
+    if (statusA != statusB) {
+        return "error status";
+    }
+    if (a->PC != b->PC) {
+        return "PC";
+    }
+    if (a->PSR != b->PSR) {
+        return "PSR";
+    }
+    for (int i = 0; i < 8; i++) {
+        if (a->R[i] != b->R[i]) {
+            return registers[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the name of the first field that differs after both engines ran one instruction,
+ * including the store it made, or NULL if they agree.
+ */
+const char* CompareState(MachineState* a, int statusA, MachineState* b, int statusB)
+{
+    const char* field = CompareRegisters(a, statusA, b, statusB);
+    if (field != NULL) {
+        return field;
+    }
+    if (a->DATA_WE != b->DATA_WE || (a->DATA_WE && (a->dmemAddr != b->dmemAddr || a->dmemValue != b->dmemValue))) {
+        return "store";
+    }
+    return NULL;
+}
+
+//folds the store made by the last instruction into hash
+unsigned long long HashStore(unsigned long long hash, MachineState* CPU)
+{
+    hash ^= ((unsigned long long) CPU->dmemAddr << 16u) | CPU->dmemValue;
+    return hash * 0x100000001B3ull;
+}
+
+void PrintState(const char* name, MachineState* CPU, int status)
+{
+    printf("  %-10s PC=%04X PSR=%04X", name, CPU->PC, CPU->PSR);
+    for (int i = 0; i < 8; i++) {
+        printf(" R%d=%04X", i, CPU->R[i]);
+    }
+    if (CPU->DATA_WE) {
+        printf(" store=%04X:%04X", CPU->dmemAddr, CPU->dmemValue);
+    }
+    if (status != 0) {
+        printf(" (error)");
+    }
+    printf("\n");
+}
+
+/*
+ * Reports the divergence found after cycle, history only holds instructions from cycle first on.
+ */
+void ReportDivergence(const char* field, unsigned long long cycle, unsigned long long first, Engine* refEngine, int refStatus, Engine* testEngine, int testStatus)
+{
+    char text[32];
+    HistoryEntry* last = &history[(cycle - 1) % HISTORY_SIZE];
+    Disassemble(last->instruction, text);
+    printf("divergence in %s at cycle %llu, after x%04X %s\n", field, cycle, last->PC, text);
+    PrintState(refEngine->name, &ref, refStatus);
+    PrintState(testEngine->name, &test, testStatus);
+    printf("  previous instructions:\n");
+    unsigned long long i = (cycle > HISTORY_SIZE) ? cycle - HISTORY_SIZE : 0;
+    for (i = (i < first) ? first : i; i + 1 < cycle; i++) {
+        Disassemble(history[i % HISTORY_SIZE].instruction, text);
+        printf("    x%04X %s\n", history[i % HISTORY_SIZE].PC, text);
+    }
+}
+
+//copies the whole machine, including its memory, keeping dst's own memory
+void CopyState(MachineState* dst, MachineState* src)
+{
+    unsigned short int* memory = dst->memory;
+    memcpy(dst, src, sizeof(MachineState));
+    dst->memory = memory;
+    memcpy(dst->memory, src->memory, 65536 * sizeof(unsigned short int));
+}
+
+//the checkpoint becomes the previous one and ref at cycle the new one
+void TakeCheckpoint(unsigned long long cycle)
+{
+    MachineState oldest = previous;
+    previous = checkpoint;
+    checkpoint = oldest;
+    previous_cycle = checkpoint_cycle;
+    CopyState(&checkpoint, &ref);
+    checkpoint_cycle = cycle;
+}
+
+/*
+ * Runs both engines with full compares from the previous checkpoint up to cycle end.
+ * Returns 1 after reporting the divergence.
+ */
+int Replay(Engine* refEngine, Engine* testEngine, unsigned long long end)
+{
+    int refStatus, testStatus;
+    const char* field;
+    unsigned long long start = previous_cycle;
+    CopyState(&ref, &previous);
+    CopyState(&test, &previous);
+    for (unsigned long long cycle = start; cycle < end; cycle++) {
+        history[cycle % HISTORY_SIZE].PC = ref.PC;
+        history[cycle % HISTORY_SIZE].instruction = ref.memory[ref.PC];
+        refStatus = refEngine->step(&ref);
+        testStatus = testEngine->step(&test);
+        field = CompareState(&ref, refStatus, &test, testStatus);
+        if (field != NULL) {
+            ReportDivergence(field, cycle + 1, start, refEngine, refStatus, testEngine, testStatus);
+            return 1;
+        }
+    }
+    //nothing differs instruction by instruction, so it must be memory outside of the stores
+    for (int i = 0; i < 65536; i++) {
+        if (ref.memory[i] != test.memory[i]) {
+            printf("divergence in memory at x%04X between cycles %llu and %llu: %s=%04X %s=%04X\n",
+                   i, start, end, refEngine->name, ref.memory[i], testEngine->name, test.memory[i]);
+            return 1;
+        }
+    }
+    printf("divergence between cycles %llu and %llu did not reproduce on replay\n", start, end);
+    return 1;
+}
+
+/*
+ * Runs the engines side by side. Returns 0 if they agree and 1 after reporting a divergence.
+ */
+int CoSimulate(Engine* refEngine, Engine* testEngine, unsigned long long warmup, unsigned long long period, unsigned long long maxCycles)
+{
+    unsigned long long cycle = 0;
+    unsigned long long refHash = 0xCBF29CE484222325ull, testHash = 0xCBF29CE484222325ull;
+    int refStatus = 0, testStatus = 0;
+    const char* field;
+    CopyState(&test, &ref);
+    CopyState(&checkpoint, &ref);
+    //full compares during the warmup
+    while (cycle < warmup && cycle < maxCycles && ref.PC != HALT_PC) {
+        history[cycle % HISTORY_SIZE].PC = ref.PC;
+        history[cycle % HISTORY_SIZE].instruction = ref.memory[ref.PC];
+        refStatus = refEngine->step(&ref);
+        testStatus = testEngine->step(&test);
+        cycle++;
+        field = CompareState(&ref, refStatus, &test, testStatus);
+        if (field != NULL) {
+            ReportDivergence(field, cycle, 0, refEngine, refStatus, testEngine, testStatus);
+            return 1;
+        }
+        if (refStatus != 0) {
+            break;
+        }
+    }
+    TakeCheckpoint(cycle);
+    //hashed compares after it
+    while (refStatus == 0 && cycle < maxCycles && ref.PC != HALT_PC) {
+        refStatus = refEngine->step(&ref);
+        testStatus = testEngine->step(&test);
+        cycle++;
+        if (ref.DATA_WE) {
+            refHash = HashStore(refHash, &ref);
+        }
+        if (test.DATA_WE) {
+            testHash = HashStore(testHash, &test);
+        }
+        if (cycle % period == 0 || refStatus != 0 || testStatus != 0) {
+            if (refHash != testHash || CompareRegisters(&ref, refStatus, &test, testStatus) != NULL) {
+                return Replay(refEngine, testEngine, cycle);
+            }
+            TakeCheckpoint(cycle);
+        }
+    }
+    //the final states, including all of memory, must match
+    if (refHash != testHash || CompareRegisters(&ref, refStatus, &test, testStatus) != NULL) {
+        return Replay(refEngine, testEngine, cycle);
+    }
+    //memory changed without a store is not visible to a replay from the checkpoint, so report it as it is
+    for (int i = 0; i < 65536; i++) {
+        if (ref.memory[i] != test.memory[i]) {
+            printf("divergence in memory at x%04X after %llu cycles: %s=%04X %s=%04X\n",
+                   i, cycle, refEngine->name, ref.memory[i], testEngine->name, test.memory[i]);
+            return 1;
+        }
+    }
+    printf("match: %llu cycles\n", cycle);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Engine* refEngine = &engines[0];
+    Engine* testEngine = &engines[1];
+    unsigned long long warmup = DEFAULT_WARMUP;
+    unsigned long long period = DEFAULT_PERIOD;
+    unsigned long long maxCycles = 0xFFFFFFFFFFFFFFFFull;
+    int i = 1;
+    //parses the options in front of the object files
+    while (i + 1 < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-ref") == 0) {
+            refEngine = FindEngine(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-test") == 0) {
+            testEngine = FindEngine(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-warmup") == 0) {
+            if (ParseCycles(argv[i + 1], &warmup) != 0) {
+                printf("error: invalid warmup %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-period") == 0) {
+            if (ParseCycles(argv[i + 1], &period) != 0 || period == 0) {
+                printf("error: invalid period %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-cycles") == 0) {
+            if (ParseCycles(argv[i + 1], &maxCycles) != 0) {
+                printf("error: invalid cycle count %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else {
+            printf("error: unknown option %s\n", argv[i]);
+            return -1;
+        }
+        if (refEngine == NULL || testEngine == NULL) {
+            return -1;
+        }
+        i += 2;
+    }
+    if (i == argc) {
+        printf("error: you must specify at least one object file\n");
+        return -1;
+    }
+    null_output = fopen("/dev/null", "w");
+    if (null_output == NULL) {
+        printf("error: could not open /dev/null\n");
+        return -1;
+    }
+    //loads the programs into the reference machine, CoSimulate copies it to the other
+    ref.memory = ref_memory;
+    test.memory = test_memory;
+    checkpoint.memory = checkpoint_memory;
+    previous.memory = previous_memory;
+    ref.PC = 0x8200;
+    ref.PSR = 0x8002;
+    if (LoadObjectFiles(&argv[i], argc - i, &ref, NULL) != 0) {
+        return -1;
+    }
+    int result = CoSimulate(refEngine, testEngine, warmup, period, maxCycles);
+    fclose(null_output);
+    return result;
+}
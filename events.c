@@ -0,0 +1,303 @@
+/*
+ * events.c: Defines stop conditions, breakpoints and watchpoints for the simulator
+ *
+ * The run loop pays for exactly one bitmap test per cycle (pcMap, which also holds the halt
+ * PCs that used to be a hard-coded compare) and one countdown decrement. Everything else -
+ * cycle limits, register conditions and watchpoint hits - is only looked at when the
+ * countdown reaches 0. Watchpoints force that by cutting the current countdown short.
+ */
+
+#include "events.h"
+#include <errno.h>
+
+static void SetBit(unsigned char* map, unsigned short int address)
+{
+    map[address >> 3u] |= 1u << (address & 7u);
+}
+
+static void ClearBit(unsigned char* map, unsigned short int address)
+{
+    map[address >> 3u] &= ~(1u << (address & 7u));
+}
+
+//rebuilds the byte of pcMap covering address
+static void UpdatePCMap(EventState* events, unsigned short int address)
+{
+    events->pcMap[address >> 3u] = events->haltMap[address >> 3u] | events->breakMap[address >> 3u];
+}
+
+//accounts for the cycles run in the current window and starts a new one
+static void SettleCountdown(EventState* events)
+{
+    unsigned long long executed = events->window - events->countdown;
+    events->cycles += executed;
+    if (events->limit != NO_CYCLE_LIMIT) {
+        events->limit -= executed;
+    }
+    if (events->numConditions > 0) {
+        events->window = 1;
+    }
+    else if (events->limit != NO_CYCLE_LIMIT && events->limit > 0) {
+        events->window = events->limit;
+    }
+    else {
+        events->window = NO_CYCLE_LIMIT;
+    }
+    events->countdown = events->window;
+}
+
+//returns 1 if any register condition holds
+static int CheckConditions(MachineState* CPU, EventState* events)
+{
+    unsigned short int value;
+    for (int i = 0; i < events->numConditions; i++) {
+        if (events->conditions[i].reg == REG_PC) {
+            value = CPU->PC;
+        }
+        else if (events->conditions[i].reg == REG_PSR) {
+            value = CPU->PSR;
+        }
+        else {
+            value = CPU->R[events->conditions[i].reg];
+        }
+        if (value == events->conditions[i].value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//handles the end of a countdown window, returns the reason to stop or STOP_NONE
+static int CheckEvents(MachineState* CPU, EventState* events)
+{
+    int reason = STOP_NONE;
+    SettleCountdown(events);
+    if (events->pending != STOP_NONE) {
+        reason = events->pending;
+        events->pending = STOP_NONE;
+    }
+    else if (events->numConditions > 0 && CheckConditions(CPU, events)) {
+        reason = STOP_REGISTER;
+        events->stopAddr = CPU->PC;
+    }
+    else if (events->limit == 0) {
+        reason = STOP_CYCLE_LIMIT;
+        events->stopAddr = CPU->PC;
+    }
+    return reason;
+}
+
+
+/*
+ * Clear all stop conditions.
+ */
+void InitEvents(EventState* events)
+{
+    memset(events, 0, sizeof(*events));
+    events->limit = NO_CYCLE_LIMIT;
+    events->window = NO_CYCLE_LIMIT;
+    events->countdown = NO_CYCLE_LIMIT;
+}
+
+
+/*
+ * Stop before executing the instruction at address.
+ */
+void AddHaltPC(EventState* events, unsigned short int address)
+{
+    SetBit(events->haltMap, address);
+    UpdatePCMap(events, address);
+}
+
+
+/*
+ * Add or remove a breakpoint.
+ */
+void AddBreakpoint(EventState* events, unsigned short int address)
+{
+    SetBit(events->breakMap, address);
+    UpdatePCMap(events, address);
+}
+
+void RemoveBreakpoint(EventState* events, unsigned short int address)
+{
+    ClearBit(events->breakMap, address);
+    UpdatePCMap(events, address);
+}
+
+
+/*
+ * Add or remove a data watchpoint.
+ */
+void AddWatchpoint(EventState* events, unsigned short int address, int kind)
+{
+    if ((kind & WATCH_READ) && !EVENT_TEST(events->readMap, address)) {
+        SetBit(events->readMap, address);
+        events->numWatch++;
+    }
+    if ((kind & WATCH_WRITE) && !EVENT_TEST(events->writeMap, address)) {
+        SetBit(events->writeMap, address);
+        events->numWatch++;
+    }
+}
+
+void RemoveWatchpoint(EventState* events, unsigned short int address, int kind)
+{
+    if ((kind & WATCH_READ) && EVENT_TEST(events->readMap, address)) {
+        ClearBit(events->readMap, address);
+        events->numWatch--;
+    }
+    if ((kind & WATCH_WRITE) && EVENT_TEST(events->writeMap, address)) {
+        ClearBit(events->writeMap, address);
+        events->numWatch--;
+    }
+}
+
+
+/*
+ * Stop when register reg holds value.
+ */
+int AddRegisterCondition(EventState* events, int reg, unsigned short int value)
+{
+    if (events->numConditions == MAX_REG_CONDITIONS || reg < 0 || reg > REG_PSR) {
+        return -1;
+    }
+    events->conditions[events->numConditions].reg = reg;
+    events->conditions[events->numConditions].value = value;
+    events->numConditions++;
+    return 0;
+}
+
+
+/*
+ * Stop after the given number of further cycles.
+ */
+void SetCycleLimit(EventState* events, unsigned long long cycles)
+{
+    SettleCountdown(events);
+    events->limit = cycles;
+    SettleCountdown(events);
+}
+
+
+/*
+ * Parses a decimal number of cycles.
+ */
+int ParseCycles(char* text, unsigned long long* cycles)
+{
+    char* end;
+    //strtoull skips spaces and takes a sign, turning "-5" into a huge count
+    if (text[0] < '0' || text[0] > '9') {
+        return -1;
+    }
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE) {
+        return -1;
+    }
+    *cycles = value;
+    return 0;
+}
+
+
+/*
+ * Called by LoadOp and StoreOp when they touch a watched address. Cuts the countdown short
+ * so the run loop stops once the current instruction completes.
+ */
+void WatchHit(EventState* events, int reason, unsigned short int address)
+{
+    if (events->pending != STOP_NONE) {
+        return;
+    }
+    events->pending = reason;
+    events->stopAddr = address;
+    events->window -= events->countdown - 1;
+    events->countdown = 1;
+}
+
+
+/*
+ * Run the machine until a stop condition or an error.
+ */
+int RunMachine(MachineState* CPU, FILE* output, EventState* events)
+{
+    int reason;
+    FILE* traced;
+    //only pay for the LoadOp/StoreOp checks when there is something to watch
+    CPU->events = (events->numWatch > 0) ? events : NULL;
+    SettleCountdown(events);
+    if (events->limit == 0) {
+        events->stopAddr = CPU->PC;
+        return STOP_CYCLE_LIMIT;
+    }
+    while (1) {
+        if (EVENT_TEST(events->pcMap, CPU->PC)) {
+            SettleCountdown(events);
+            events->stopAddr = CPU->PC;
+            return EVENT_TEST(events->haltMap, CPU->PC) ? STOP_HALT : STOP_BREAKPOINT;
+        }
+        //filtered out instructions run untraced
+        traced = output;
+        if (events->filter != NULL && !TraceSelected(events->filter, CPU)) {
+            traced = NULL;
+        }
+        if (UpdateMachineState(CPU, traced) != 0) {
+            SettleCountdown(events);
+            events->pending = STOP_NONE;
+            events->stopAddr = CPU->PC;
+            return STOP_ERROR;
+        }
+        if (--events->countdown == 0) {
+            reason = CheckEvents(CPU, events);
+            if (reason != STOP_NONE) {
+                return reason;
+            }
+        }
+    }
+}
+
+
+/*
+ * Execute a single instruction, ignoring breakpoints.
+ */
+int StepMachine(MachineState* CPU, FILE* output, EventState* events)
+{
+    FILE* traced = output;
+    CPU->events = (events->numWatch > 0) ? events : NULL;
+    SettleCountdown(events);
+    events->stopAddr = CPU->PC;
+    if (EVENT_TEST(events->haltMap, CPU->PC)) {
+        return STOP_HALT;
+    }
+    if (events->limit == 0) {
+        return STOP_CYCLE_LIMIT;
+    }
+    if (events->filter != NULL && !TraceSelected(events->filter, CPU)) {
+        traced = NULL;
+    }
+    if (UpdateMachineState(CPU, traced) != 0) {
+        SettleCountdown(events);
+        events->pending = STOP_NONE;
+        return STOP_ERROR;
+    }
+    events->countdown--;
+    return CheckEvents(CPU, events);
+}
+
+
+/*
+ * Printable name of a STOP_* reason.
+ */
+const char* StopReasonName(int reason)
+{
+    switch (reason) {
+        case STOP_HALT: return "halt";
+        case STOP_BREAKPOINT: return "breakpoint";
+        case STOP_READ_WATCH: return "read watchpoint";
+        case STOP_WRITE_WATCH: return "write watchpoint";
+        case STOP_REGISTER: return "register condition";
+        case STOP_CYCLE_LIMIT: return "cycle limit";
+        case STOP_ERROR: return "error";
+        default: return "none";
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * events.h: Declares stop conditions, breakpoints and watchpoints for the simulator
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "LC4.h"
+#include "filter.h"
+
+// Reasons for RunMachine and StepMachine to return
+#define STOP_NONE         0
+#define STOP_HALT         1
+#define STOP_BREAKPOINT   2
+#define STOP_READ_WATCH   3
+#define STOP_WRITE_WATCH  4
+#define STOP_REGISTER     5
+#define STOP_CYCLE_LIMIT  6
+#define STOP_ERROR        7
+
+// Kinds of data watchpoint, may be or'ed together
+#define WATCH_READ   1
+#define WATCH_WRITE  2
+
+// Indexes of PC and PSR in a register condition, after R0-R7
+#define REG_PC   8
+#define REG_PSR  9
+
+#define MAX_REG_CONDITIONS 8
+
+// No cycle limit
+#define NO_CYCLE_LIMIT 0xFFFFFFFFFFFFFFFFull
+
+// Bitmaps over the 64K address space, one bit per address
+#define EVENT_MAP_SIZE 8192
+#define EVENT_TEST(map, addr) ((map)[(unsigned short int)(addr) >> 3u] & (1u << ((addr) & 7u)))
+
+typedef struct {
+    // 0-7 = R0-R7, REG_PC or REG_PSR
+    unsigned char reg;
+    unsigned short int value;
+} RegisterCondition;
+
+struct EventState {
+    // pcMap = haltMap | breakMap, this is the only map tested on every cycle
+    unsigned char pcMap[EVENT_MAP_SIZE];
+    unsigned char haltMap[EVENT_MAP_SIZE];
+    unsigned char breakMap[EVENT_MAP_SIZE];
+
+    // data watchpoints, tested only by LoadOp and StoreOp
+    unsigned char readMap[EVENT_MAP_SIZE];
+    unsigned char writeMap[EVENT_MAP_SIZE];
+    int numWatch;
+
+    // stop when a register holds a value, checked after every cycle while any are armed
+    RegisterCondition conditions[MAX_REG_CONDITIONS];
+    int numConditions;
+
+    // cycles left before STOP_CYCLE_LIMIT, or NO_CYCLE_LIMIT
+    unsigned long long limit;
+
+    // cycles executed by RunMachine and StepMachine so far
+    unsigned long long cycles;
+
+    // the run loop only looks at anything but pcMap when countdown reaches 0;
+    // window is the length of the current countdown
+    unsigned long long countdown;
+    unsigned long long window;
+
+    // stop raised in the middle of an instruction by a watchpoint
+    int pending;
+
+    // PC or data address responsible for the last stop
+    unsigned short int stopAddr;
+
+    // decides which instructions are written to the output, NULL traces all of them
+    TraceFilter* filter;
+};
+
+
+/*
+ * Clear all stop conditions.
+ */
+void InitEvents(EventState* events);
+
+
+/*
+ * Stop before executing the instruction at address.
+ */
+void AddHaltPC(EventState* events, unsigned short int address);
+
+
+/*
+ * Add or remove a breakpoint. Unlike halt PCs, breakpoints are ignored by StepMachine.
+ */
+void AddBreakpoint(EventState* events, unsigned short int address);
+void RemoveBreakpoint(EventState* events, unsigned short int address);
+
+
+/*
+ * Add or remove a data watchpoint on address, kind is WATCH_READ and/or WATCH_WRITE.
+ */
+void AddWatchpoint(EventState* events, unsigned short int address, int kind);
+void RemoveWatchpoint(EventState* events, unsigned short int address, int kind);
+
+
+/*
+ * Stop when register reg holds value. Returns -1 if too many conditions are armed.
+ */
+int AddRegisterCondition(EventState* events, int reg, unsigned short int value);
+
+
+/*
+ * Stop after the given number of further cycles (NO_CYCLE_LIMIT to disable).
+ */
+void SetCycleLimit(EventState* events, unsigned long long cycles);
+
+
+/*
+ * Parses a decimal number of cycles for a command-line option. Returns -1 if it is empty,
+ * negative, too big or not a number.
+ */
+int ParseCycles(char* text, unsigned long long* cycles);
+
+
+/*
+ * Run the machine until a stop condition or an error. Returns a STOP_* reason.
+ */
+int RunMachine(MachineState* CPU, FILE* output, EventState* events);
+
+
+/*
+ * Execute a single instruction, ignoring breakpoints. Returns a STOP_* reason or STOP_NONE.
+ */
+int StepMachine(MachineState* CPU, FILE* output, EventState* events);
+
+
+/*
+ * Called by LoadOp and StoreOp when they touch a watched address.
+ */
+void WatchHit(EventState* events, int reason, unsigned short int address);
+
+
+/*
+ * Printable name of a STOP_* reason.
+ */
+const char* StopReasonName(int reason);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * filter.c: Defines trace filters that decide which instructions get a trace line
+ *
+ * The decision is made before the instruction executes, from its PC and opcode, so the run
+ * loop can hand UpdateMachineState a NULL output and skip all of the formatting.
+ */
+
+#include "filter.h"
+#include <math.h>
+
+typedef struct {
+    const char* name;
+    unsigned short int opcodes;
+} OpcodeClass;
+
+const OpcodeClass opcode_classes[] = {
+    {"arith", 1 << 1},
+    {"compare", 1 << 2},
+    {"logic", 1 << 5},
+    {"shift", 1 << 10},
+    {"load", 1 << 6},
+    {"store", 1 << 7},
+    {"memory", (1 << 6) | (1 << 7)},
+    {"const", (1 << 9) | (1 << 13)},
+    {"branch", 1 << 0},
+    // JMP, JSR, RTI and TRAP
+    {"jump", (1 << 12) | (1 << 4) | (1 << 8) | (1 << 15)},
+    {"control", (1 << 0) | (1 << 12) | (1 << 4) | (1 << 8) | (1 << 15)},
+};
+
+//xorshift64*, as a number in (0, 1]
+static double RandomUnit(TraceFilter* filter)
+{
+    filter->rng ^= filter->rng >> 12u;
+    filter->rng ^= filter->rng << 25u;
+    filter->rng ^= filter->rng >> 27u;
+    return ((filter->rng * 0x2545F4914F6CDD1Dull >> 11u) + 1) / 9007199254740992.0;
+}
+
+//instructions until the next sample: always period, or geometric with mean period for random sampling
+static unsigned long long NextSample(TraceFilter* filter)
+{
+    if (!filter->random || filter->period <= 1) {
+        return filter->period;
+    }
+    return (unsigned long long) (log(RandomUnit(filter)) / log(1.0 - 1.0 / filter->period)) + 1;
+}
+
+
+/*
+ * Set up a filter that traces every instruction.
+ */
+void InitFilter(TraceFilter* filter)
+{
+    filter->low = 0x0000;
+    filter->high = 0xFFFF;
+    filter->opcodes = 0xFFFF;
+    filter->period = 0;
+    filter->random = 0;
+    filter->countdown = 0;
+    filter->rng = 0x9E3779B97F4A7C15ull;
+}
+
+
+/*
+ * Only trace opcode classes from a comma separated list.
+ */
+int SetOpcodeClasses(TraceFilter* filter, char* list)
+{
+    unsigned short int opcodes = 0;
+    char* name = strtok(list, ",");
+    while (name != NULL) {
+        int found = 0;
+        for (int i = 0; i < sizeof(opcode_classes) / sizeof(opcode_classes[0]); i++) {
+            if (strcmp(name, opcode_classes[i].name) == 0) {
+                opcodes |= opcode_classes[i].opcodes;
+                found = 1;
+            }
+        }
+        if (!found) {
+            return -1;
+        }
+        name = strtok(NULL, ",");
+    }
+    filter->opcodes = opcodes;
+    return 0;
+}
+
+
+/*
+ * Only trace every Nth instruction that passes the other filters, or a random 1 in N.
+ */
+void SetSampling(TraceFilter* filter, unsigned long long period, int random)
+{
+    filter->period = period;
+    filter->random = random;
+    filter->countdown = NextSample(filter);
+}
+
+
+/*
+ * Returns 1 if the instruction about to execute at CPU->PC should be traced.
+ */
+int TraceSelected(TraceFilter* filter, MachineState* CPU)
+{
+    if (CPU->PC < filter->low || CPU->PC > filter->high) {
+        return 0;
+    }
+    if ((filter->opcodes & (1u << (CPU->memory[CPU->PC] >> 12u))) == 0) {
+        return 0;
+    }
+    if (filter->period == 0) {
+        return 1;
+    }
+    if (--filter->countdown > 0) {
+        return 0;
+    }
+    filter->countdown = NextSample(filter);
+    return 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * filter.h: Declares trace filters that decide which instructions get a trace line
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "LC4.h"
+
+typedef struct {
+    // only instructions at PCs from low to high (inclusive) are traced
+    unsigned short int low;
+    unsigned short int high;
+
+    // bit n set = trace instructions with opcode n
+    unsigned short int opcodes;
+
+    // of the instructions left, trace every Nth (random = 0) or a random 1 in N (random = 1)
+    unsigned long long period;
+    int random;
+
+    // instructions left until the next sample, and the state of the random number generator
+    unsigned long long countdown;
+    unsigned long long rng;
+} TraceFilter;
+
+
+/*
+ * Set up a filter that traces every instruction.
+ */
+void InitFilter(TraceFilter* filter);
+
+
+/*
+ * Only trace opcode classes from a comma separated list such as "store,branch". Classes are
+ * arith, compare, logic, shift, load, store, memory, const, branch, jump and control.
+ * Returns -1 if a class is not known.
+ */
+int SetOpcodeClasses(TraceFilter* filter, char* list);
+
+
+/*
+ * Only trace every Nth instruction that passes the other filters, or a random 1 in N if random is set.
+ */
+void SetSampling(TraceFilter* filter, unsigned long long period, int random);
+
+
+/*
+ * Returns 1 if the instruction about to execute at CPU->PC should be traced.
+ */
+int TraceSelected(TraceFilter* filter, MachineState* CPU);
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ * fuzz.c: location of main() for the instruction stream fuzzer
+ *
+ * Every program is generated from its own seed straight into CPU->memory: random code at
+ * the boot address x8200, in the trap vectors and in user code at x0000, plus a little data.
+ * It then runs untraced for at most -cycles instructions while the invariants below are
+ * checked after every instruction. Workers reuse one MachineState each and only clear the
+ * words a program wrote, so a program costs about as much as the instructions it runs.
+ *
+ * fuzz -program SEED reruns a single program and prints its trace.
+ */
+
+#include "LC4.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// Default number of programs and cycle cap per program
+#define DEFAULT_PROGRAMS 1000000
+#define DEFAULT_CYCLES 1000
+
+// Largest cycle cap, every cycle may add a word to the dirty list
+#define MAX_CYCLES (1 << 24)
+
+// Workers are kept on cache lines of their own, they write their counters on every instruction
+#define CACHE_LINE 64
+
+// The machine is done when it reaches this PC, as in trace
+#define HALT_PC 0x80FF
+
+// Most violations printed before the rest are only counted
+#define MAX_REPORTS 10
+
+// Regions a program is generated into: start address and largest length
+#define NUM_REGIONS 5
+const unsigned short int region_start[NUM_REGIONS] = {0x8200, 0x8000, 0x0000, 0x4000, 0xA000};
+const unsigned short int region_length[NUM_REGIONS] = {64, 256, 64, 16, 16};
+
+// Kinds of error a program can end with
+#define ERROR_ILLEGAL 0
+#define ERROR_PC 1
+#define ERROR_DATA 2
+#define NUM_ERRORS 3
+const char* error_names[NUM_ERRORS] = {"illegal opcode", "PC out of range", "load/store permission"};
+
+typedef struct {
+    MachineState* CPU;
+    MachineState machine;
+    int index;
+    unsigned long long rng;
+
+    // words written by the generator or by stores, cleared before the next program
+    unsigned short int* dirty;
+    int numDirty;
+
+    // results
+    unsigned long long programs;
+    unsigned long long instructions;
+    unsigned long long halts;
+    unsigned long long caps;
+    unsigned long long errors[NUM_ERRORS];
+    unsigned long long violations;
+} __attribute__((aligned(CACHE_LINE))) Worker;
+
+int num_threads;
+unsigned long long num_programs = DEFAULT_PROGRAMS;
+unsigned long long cycle_cap = DEFAULT_CYCLES;
+unsigned long long base_seed = 1;
+
+// Reports go here, the simulator's own error messages are turned off
+FILE* report;
+pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+int num_reports = 0;
+
+
+//seed of the program with the given index
+unsigned long long ProgramSeed(unsigned long long index)
+{
+    unsigned long long z = base_seed + index * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31u);
+}
+
+//xorshift64*
+unsigned int Random(Worker* worker)
+{
+    worker->rng ^= worker->rng >> 12u;
+    worker->rng ^= worker->rng << 25u;
+    worker->rng ^= worker->rng >> 27u;
+    return (unsigned int) ((worker->rng * 0x2545F4914F6CDD1Dull) >> 32u);
+}
+
+//a random instruction, one in ten is any 16-bit word at all
+unsigned short int RandomInstruction(Worker* worker)
+{
+    static const unsigned short int opcodes[13] = {0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 12, 13, 15};
+    unsigned int bits = Random(worker);
+    if (bits % 10 == 0) {
+        return (unsigned short int) (bits >> 8u);
+    }
+    return (opcodes[(bits >> 4u) % 13] << 12u) | ((bits >> 12u) & 0x0FFF);
+}
+
+void MarkDirty(Worker* worker, unsigned short int address)
+{
+    worker->dirty[worker->numDirty++] = address;
+}
+
+//clears what the previous program wrote and generates the next one
+void Generate(Worker* worker, unsigned long long seed)
+{
+    MachineState* CPU = worker->CPU;
+    for (int i = 0; i < worker->numDirty; i++) {
+        CPU->memory[worker->dirty[i]] = 0;
+    }
+    worker->numDirty = 0;
+    worker->rng = seed | 1;
+    ClearSignals(CPU);
+    CPU->PC = 0x8200;
+    CPU->PSR = 0x8002;
+    for (int i = 0; i < 8; i++) {
+        CPU->R[i] = Random(worker);
+    }
+    //half of the programs return straight to the user code from the first RTI
+    if (Random(worker) & 1) {
+        CPU->R[7] = 0x0000;
+    }
+    for (int r = 0; r < NUM_REGIONS; r++) {
+        int length = Random(worker) % (region_length[r] + 1);
+        for (int i = 0; i < length; i++) {
+            CPU->memory[region_start[r] + i] = RandomInstruction(worker);
+            MarkDirty(worker, region_start[r] + i);
+        }
+    }
+}
+
+//which kind of error stopped the program at CPU->PC
+int ClassifyError(MachineState* CPU)
+{
+    unsigned short int opcode = CPU->memory[CPU->PC] >> 12u;
+    if (CheckPermissions(CPU, CPU->PC) != 0) {
+        return ERROR_PC;
+    }
+    if (opcode == 6 || opcode == 7) {
+        return ERROR_DATA;
+    }
+    return ERROR_ILLEGAL;
+}
+
+/*
+ * Checks the state after one instruction, given the PC and PSR from before it. Returns a
+ * description of the first invariant that does not hold, or NULL.
+ */
+const char* CheckInvariants(MachineState* CPU, unsigned short int pc, unsigned short int psr, int status)
+{
+    unsigned short int nzp = CPU->PSR & 0x0007;
+    unsigned short int opcode = CPU->memory[pc] >> 12u;
+    if (status != 0) {
+        if (CPU->PC != pc) {
+            return "PC moved past an instruction that failed";
+        }
+        return NULL;
+    }
+    if ((CPU->PSR & 0x7FF8) != 0) {
+        return "PSR bits 3..14 are not zero";
+    }
+    if (nzp != 1 && nzp != 2 && nzp != 4) {
+        return "NZP is not one-hot";
+    }
+    if (CPU->NZP_WE && CPU->NZPVal != nzp) {
+        return "NZP value written does not match the PSR";
+    }
+    if ((psr & 0x8000) == 0 && (CPU->PSR & 0x8000) != 0 && opcode != 15) {
+        return "privilege raised by something other than TRAP";
+    }
+    if ((psr & 0x8000) == 0 && pc >= 0x8000) {
+        return "user mode instruction executed from OS memory";
+    }
+    if ((psr & 0x8000) == 0 && CPU->DATA_WE && CPU->dmemAddr >= 0x8000) {
+        return "user mode store into OS memory";
+    }
+    if ((psr & 0x8000) == 0 && opcode == 6 && CPU->dmemAddr >= 0x8000) {
+        return "user mode load from OS memory";
+    }
+    return NULL;
+}
+
+void PrintViolation(Worker* worker, unsigned long long seed, unsigned long long cycle, unsigned short int pc, const char* violation)
+{
+    char text[32];
+    MachineState* CPU = worker->CPU;
+    pthread_mutex_lock(&report_lock);
+    if (num_reports < MAX_REPORTS) {
+        Disassemble(CPU->memory[pc], text);
+        fprintf(report, "violation: %s\n", violation);
+        fprintf(report, "  seed %llu (rerun with fuzz -program %llu), cycle %llu, after x%04X %s\n",
+                seed, seed, cycle, pc, text);
+        fprintf(report, "  PC=%04X PSR=%04X", CPU->PC, CPU->PSR);
+        for (int i = 0; i < 8; i++) {
+            fprintf(report, " R%d=%04X", i, CPU->R[i]);
+        }
+        fprintf(report, " NZP_WE=%d NZPVal=%d\n", CPU->NZP_WE, CPU->NZPVal);
+    }
+    num_reports++;
+    pthread_mutex_unlock(&report_lock);
+}
+
+/*
+ * Runs one generated program, tracing it to output if that is not NULL. Returns 1 if an
+ * invariant failed.
+ */
+int RunProgram(Worker* worker, unsigned long long seed, FILE* output)
+{
+    MachineState* CPU = worker->CPU;
+    unsigned short int pc, psr;
+    const char* violation;
+    int status;
+    Generate(worker, seed);
+    worker->programs++;
+    for (unsigned long long cycle = 0; cycle < cycle_cap; cycle++) {
+        if (CPU->PC == HALT_PC) {
+            worker->halts++;
+            return 0;
+        }
+        pc = CPU->PC;
+        psr = CPU->PSR;
+        status = UpdateMachineState(CPU, output);
+        worker->instructions++;
+        if (CPU->DATA_WE && status == 0) {
+            MarkDirty(worker, CPU->dmemAddr);
+        }
+        violation = CheckInvariants(CPU, pc, psr, status);
+        if (violation != NULL) {
+            worker->violations++;
+            PrintViolation(worker, seed, cycle, pc, violation);
+            return 1;
+        }
+        if (status != 0) {
+            worker->errors[ClassifyError(CPU)]++;
+            return 0;
+        }
+    }
+    worker->caps++;
+    return 0;
+}
+
+void* RunWorker(void* arg)
+{
+    Worker* worker = (Worker*) arg;
+    for (unsigned long long i = worker->index; i < num_programs; i += num_threads) {
+        RunProgram(worker, ProgramSeed(i), NULL);
+    }
+    return NULL;
+}
+
+int InitWorker(Worker* worker, int index)
+{
+    size_t dirtySize = cycle_cap;
+    memset(worker, 0, sizeof(*worker));
+    for (int r = 0; r < NUM_REGIONS; r++) {
+        dirtySize += region_length[r];
+    }
+    //rounded up to whole cache lines, so no two workers write the same one
+    dirtySize = (dirtySize * sizeof(unsigned short int) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    worker->index = index;
+    worker->CPU = &worker->machine;
+    worker->dirty = aligned_alloc(CACHE_LINE, dirtySize);
+    worker->CPU->memory = malloc(65536 * sizeof(unsigned short int));
+    if (worker->dirty == NULL || worker->CPU->memory == NULL) {
+        return -1;
+    }
+    worker->CPU->quiet = 1;
+    Reset(worker->CPU);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long program = 0;
+    int single = 0;
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    //parses the options
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            printf("error: option %s needs a value\n", argv[i]);
+            return -1;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            num_programs = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-cycles") == 0) {
+            char* end;
+            cycle_cap = strtoull(argv[i + 1], &end, 10);
+            if (*end != '\0' || cycle_cap > MAX_CYCLES) {
+                printf("error: invalid cycle cap %s, the largest is %d\n", argv[i + 1], MAX_CYCLES);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-seed") == 0) {
+            base_seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            num_threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-program") == 0) {
+            program = strtoull(argv[i + 1], NULL, 10);
+            single = 1;
+        }
+        else {
+            printf("error: unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    report = stdout;
+
+    if (single) {
+        Worker worker;
+        if (InitWorker(&worker, 0) != 0) {
+            fprintf(report, "error: out of memory\n");
+            return -1;
+        }
+        int result = RunProgram(&worker, program, report);
+        fprintf(report, "%llu instructions, %s\n", worker.instructions,
+                result ? "invariant violated" : worker.halts ? "halted" : worker.caps ? "hit the cycle cap" : "stopped on an error");
+        fclose(report);
+        return result;
+    }
+
+    Worker* workers = aligned_alloc(CACHE_LINE, num_threads * sizeof(Worker));
+    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+    struct timespec start, end;
+    if (workers == NULL || threads == NULL) {
+        fprintf(report, "error: out of memory\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    //every worker is set up before any of them runs, so a failure leaves nothing running
+    for (int i = 0; i < num_threads; i++) {
+        if (InitWorker(&workers[i], i) != 0) {
+            fprintf(report, "error: out of memory\n");
+            return -1;
+        }
+    }
+    int started = 0;
+    while (started < num_threads && pthread_create(&threads[started], NULL, RunWorker, &workers[started]) == 0) {
+        started++;
+    }
+    //workers that could not be started run on this thread, so every program is still run
+    for (int i = started; i < num_threads; i++) {
+        RunWorker(&workers[i]);
+    }
+    //adds up the results
+    Worker total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < num_threads; i++) {
+        if (i < started) {
+            pthread_join(threads[i], NULL);
+        }
+        total.programs += workers[i].programs;
+        total.instructions += workers[i].instructions;
+        total.halts += workers[i].halts;
+        total.caps += workers[i].caps;
+        total.violations += workers[i].violations;
+        for (int e = 0; e < NUM_ERRORS; e++) {
+            total.errors[e] += workers[i].errors[e];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(report, "programs:     %llu on %d threads in %.2f s\n", total.programs, started + (started < num_threads), seconds);
+    fprintf(report, "executions/s: %.0f\n", total.programs / seconds);
+    fprintf(report, "instructions: %llu (%.0f/s)\n", total.instructions, total.instructions / seconds);
+    fprintf(report, "halted:       %llu\n", total.halts);
+    fprintf(report, "cycle cap:    %llu\n", total.caps);
+    for (int e = 0; e < NUM_ERRORS; e++) {
+        fprintf(report, "%s: %llu\n", error_names[e], total.errors[e]);
+    }
+    fprintf(report, "violations:   %llu\n", total.violations);
+    fclose(report);
+    return total.violations > 0;
+}
@@ -0,0 +1,479 @@
+/*
+ * gdbstub.c: Defines a GDB remote serial protocol server for the simulator
+ */
+
+#include "gdbstub.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Stop reason for an interrupt (^C) from the debugger, alongside the STOP_* reasons
+#define GDB_INTERRUPT -1
+
+typedef struct {
+    int fd;
+    // set once the debugger has asked for QStartNoAckMode
+    int noAck;
+    // bytes received but not consumed yet
+    unsigned char buffer[4096];
+    int length;
+    int position;
+    // addresses watched by Z4 (access) watchpoints, which gdb expects reported as awatch
+    unsigned char accessMap[EVENT_MAP_SIZE];
+} GDBConnection;
+
+
+/*
+ * Open the socket and wait for the debugger to connect.
+ */
+int ListenGDB(char* address)
+{
+    char* end;
+    int fd, client, on = 1;
+    long port = strtol(address, &end, 10);
+    //a number is a TCP port on localhost, anything else is the path of a Unix socket
+    if (*address != '\0' && *end == '\0') {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short int) port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    else {
+        struct sockaddr_un addr;
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+        //only a socket left over from an earlier run is removed, never a file named by mistake
+        struct stat info;
+        if (lstat(address, &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(address);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    printf("waiting for gdb on %s\n", address);
+    fflush(stdout);
+    client = accept(fd, NULL, NULL);
+    close(fd);
+    if (client >= 0 && *end == '\0') {
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return client;
+}
+
+//returns the next byte from the debugger, or -1 once it has gone away
+static int ReadByte(GDBConnection* conn)
+{
+    if (conn->position == conn->length) {
+        int received = recv(conn->fd, conn->buffer, sizeof(conn->buffer), 0);
+        if (received <= 0) {
+            return -1;
+        }
+        conn->length = received;
+        conn->position = 0;
+    }
+    return conn->buffer[conn->position++];
+}
+
+//checks for a ^C from the debugger without blocking
+static int PollInterrupt(GDBConnection* conn)
+{
+    if (conn->position == conn->length) {
+        int received = recv(conn->fd, conn->buffer, sizeof(conn->buffer), MSG_DONTWAIT);
+        if (received <= 0) {
+            return 0;
+        }
+        conn->length = received;
+        conn->position = 0;
+    }
+    if (conn->buffer[conn->position] == 0x03) {
+        conn->position++;
+        return 1;
+    }
+    return 0;
+}
+
+static int HexValue(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+//parses hex digits starting at *text and leaves *text after them
+static unsigned long ParseHex(char** text)
+{
+    unsigned long value = 0;
+    while (HexValue(**text) >= 0) {
+        value = (value << 4u) | HexValue(**text);
+        (*text)++;
+    }
+    return value;
+}
+
+//reads one packet into packet, acknowledging it. Returns its length or -1 once the debugger has gone away
+static int ReadPacket(GDBConnection* conn, char* packet)
+{
+    int c, length, checksum, sum;
+    while (1) {
+        //anything outside of a packet (acks, stray ^C) is skipped
+        do {
+            c = ReadByte(conn);
+            if (c < 0) {
+                return -1;
+            }
+        } while (c != '$');
+        length = 0;
+        sum = 0;
+        while ((c = ReadByte(conn)) != '#') {
+            if (c < 0) {
+                return -1;
+            }
+            if (length < GDB_PACKET_SIZE - 1) {
+                packet[length++] = (char) c;
+            }
+            sum = (sum + c) & 0xFF;
+        }
+        packet[length] = '\0';
+        checksum = HexValue(ReadByte(conn)) << 4u;
+        checksum |= HexValue(ReadByte(conn));
+        if (conn->noAck) {
+            return length;
+        }
+        if (checksum == sum) {
+            send(conn->fd, "+", 1, 0);
+            return length;
+        }
+        send(conn->fd, "-", 1, 0);
+    }
+}
+
+//sends a packet, resending it until the debugger acknowledges it
+static int SendPacket(GDBConnection* conn, char* data)
+{
+    static char frame[GDB_PACKET_SIZE + 4];
+    int length = strlen(data);
+    int sum = 0;
+    int c;
+    for (int i = 0; i < length; i++) {
+        sum = (sum + (unsigned char) data[i]) & 0xFF;
+    }
+    frame[0] = '$';
+    memcpy(frame + 1, data, length);
+    sprintf(frame + 1 + length, "#%02x", sum);
+    do {
+        if (send(conn->fd, frame, length + 4, 0) != length + 4) {
+            return -1;
+        }
+        if (conn->noAck) {
+            return 0;
+        }
+        c = ReadByte(conn);
+    } while (c == '-');
+    return c < 0 ? -1 : 0;
+}
+
+//formats the stop reply packet for reason
+static void StopReply(GDBConnection* conn, char* reply, EventState* events, int reason)
+{
+    if (reason == STOP_HALT) {
+        strcpy(reply, "W00");
+    }
+    else if (reason == STOP_ERROR) {
+        strcpy(reply, "S04");
+    }
+    else if (reason == GDB_INTERRUPT) {
+        strcpy(reply, "S02");
+    }
+    else if ((reason == STOP_READ_WATCH || reason == STOP_WRITE_WATCH) && EVENT_TEST(conn->accessMap, events->stopAddr)) {
+        sprintf(reply, "T05awatch:%04x;", events->stopAddr);
+    }
+    else if (reason == STOP_READ_WATCH) {
+        sprintf(reply, "T05rwatch:%04x;", events->stopAddr);
+    }
+    else if (reason == STOP_WRITE_WATCH) {
+        sprintf(reply, "T05watch:%04x;", events->stopAddr);
+    }
+    else {
+        strcpy(reply, "S05");
+    }
+}
+
+static unsigned short int* Register(MachineState* CPU, unsigned long reg)
+{
+    if (reg < 8) {
+        return &CPU->R[reg];
+    }
+    if (reg == REG_PC) {
+        return &CPU->PC;
+    }
+    if (reg == REG_PSR) {
+        return &CPU->PSR;
+    }
+    return NULL;
+}
+
+//runs at full speed until a stop condition, checking for ^C every GDB_POLL_CYCLES cycles
+static int Continue(GDBConnection* conn, MachineState* CPU, FILE* output, EventState* events)
+{
+    int reason;
+    unsigned long long remaining, slice, before;
+    //a breakpoint at the current PC is where we stopped last time, so step off it first
+    if (EVENT_TEST(events->breakMap, CPU->PC)) {
+        reason = StepMachine(CPU, output, events);
+        if (reason != STOP_NONE) {
+            return reason;
+        }
+    }
+    remaining = events->limit;
+    while (1) {
+        slice = remaining < GDB_POLL_CYCLES ? remaining : GDB_POLL_CYCLES;
+        before = events->cycles;
+        SetCycleLimit(events, slice);
+        reason = RunMachine(CPU, output, events);
+        if (remaining != NO_CYCLE_LIMIT) {
+            remaining -= events->cycles - before;
+        }
+        if (reason != STOP_CYCLE_LIMIT || remaining == 0) {
+            break;
+        }
+        if (PollInterrupt(conn)) {
+            reason = GDB_INTERRUPT;
+            break;
+        }
+    }
+    SetCycleLimit(events, remaining);
+    return reason;
+}
+
+//handles Z and z packets, returns -1 for types that are not supported
+static int SetStopPoint(GDBConnection* conn, EventState* events, char* args, int insert)
+{
+    int type = HexValue(args[0]);
+    unsigned long address, length;
+    if (args[1] != ',') {
+        return -1;
+    }
+    args += 2;
+    address = ParseHex(&args);
+    if (*args != ',' || address > 0xFFFF) {
+        return -1;
+    }
+    args++;
+    length = ParseHex(&args);
+    if (type == 0 || type == 1) {
+        if (insert) {
+            AddBreakpoint(events, address);
+        }
+        else {
+            RemoveBreakpoint(events, address);
+        }
+        return 0;
+    }
+    if (type < 2 || type > 4) {
+        return -1;
+    }
+    int kind = (type == 2) ? WATCH_WRITE : (type == 3) ? WATCH_READ : WATCH_READ | WATCH_WRITE;
+    if (length == 0) {
+        length = 1;
+    }
+    for (unsigned long i = 0; i < length && address + i <= 0xFFFF; i++) {
+        unsigned short int word = address + i;
+        if (insert) {
+            AddWatchpoint(events, word, kind);
+        }
+        else {
+            RemoveWatchpoint(events, word, kind);
+        }
+        if (type == 4 && insert) {
+            conn->accessMap[word >> 3u] |= 1u << (word & 7u);
+        }
+        else if (type == 4) {
+            conn->accessMap[word >> 3u] &= ~(1u << (word & 7u));
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Wait for a debugger on address and serve it until it detaches or kills the program.
+ */
+int ServeGDB(MachineState* CPU, FILE* output, EventState* events, int fd)
+{
+    static GDBConnection conn;
+    static char packet[GDB_PACKET_SIZE];
+    static char reply[GDB_PACKET_SIZE];
+    unsigned long reg, addr, length;
+    unsigned short int* value;
+    char* args;
+    int reason = STOP_NONE;
+
+    conn.fd = fd;
+    memset(conn.accessMap, 0, sizeof(conn.accessMap));
+    conn.noAck = 0;
+    conn.length = 0;
+    conn.position = 0;
+
+    while (ReadPacket(&conn, packet) >= 0) {
+        args = packet + 1;
+        reply[0] = '\0';
+        if (packet[0] == '?') {
+            StopReply(&conn, reply, events, reason == STOP_NONE ? STOP_BREAKPOINT : reason);
+        }
+        //all registers
+        else if (packet[0] == 'g') {
+            for (int i = 0; i <= REG_PSR; i++) {
+                sprintf(reply + 4 * i, "%04x", *Register(CPU, i));
+            }
+        }
+        else if (packet[0] == 'G') {
+            if (strlen(args) < 4 * (REG_PSR + 1)) {
+                strcpy(reply, "E01");
+            }
+            else {
+                for (int i = 0; i <= REG_PSR; i++) {
+                    char digits[5] = {args[4 * i], args[4 * i + 1], args[4 * i + 2], args[4 * i + 3], '\0'};
+                    char* text = digits;
+                    *Register(CPU, i) = ParseHex(&text);
+                }
+                strcpy(reply, "OK");
+            }
+        }
+        //one register
+        else if (packet[0] == 'p') {
+            value = Register(CPU, ParseHex(&args));
+            if (value == NULL) {
+                strcpy(reply, "E01");
+            }
+            else {
+                sprintf(reply, "%04x", *value);
+            }
+        }
+        else if (packet[0] == 'P') {
+            reg = ParseHex(&args);
+            value = Register(CPU, reg);
+            if (value == NULL || *args != '=') {
+                strcpy(reply, "E01");
+            }
+            else {
+                args++;
+                *value = ParseHex(&args);
+                strcpy(reply, "OK");
+            }
+        }
+        //memory, addresses and lengths count 16-bit words
+        else if (packet[0] == 'm' || packet[0] == 'M') {
+            addr = ParseHex(&args);
+            length = 0;
+            if (*args == ',') {
+                args++;
+                length = ParseHex(&args);
+            }
+            if (addr + length > 0x10000 || 4 * length >= GDB_PACKET_SIZE) {
+                strcpy(reply, "E01");
+            }
+            else if (packet[0] == 'm') {
+                for (unsigned long i = 0; i < length; i++) {
+                    sprintf(reply + 4 * i, "%04x", CPU->memory[addr + i]);
+                }
+            }
+            else if (*args != ':' || strlen(args + 1) < 4 * length) {
+                strcpy(reply, "E01");
+            }
+            else {
+                args++;
+                for (unsigned long i = 0; i < length; i++) {
+                    char digits[5] = {args[4 * i], args[4 * i + 1], args[4 * i + 2], args[4 * i + 3], '\0'};
+                    char* text = digits;
+                    CPU->memory[addr + i] = ParseHex(&text);
+                }
+                strcpy(reply, "OK");
+            }
+        }
+        //continue and step, optionally from a new PC
+        else if (packet[0] == 'c' || packet[0] == 's') {
+            if (*args != '\0') {
+                CPU->PC = ParseHex(&args);
+            }
+            if (packet[0] == 'c') {
+                reason = Continue(&conn, CPU, output, events);
+            }
+            else {
+                reason = StepMachine(CPU, output, events);
+            }
+            StopReply(&conn, reply, events, reason);
+        }
+        else if (packet[0] == 'Z' || packet[0] == 'z') {
+            if (SetStopPoint(&conn, events, args, packet[0] == 'Z') == 0) {
+                strcpy(reply, "OK");
+            }
+        }
+        else if (packet[0] == 'k') {
+            break;
+        }
+        else if (packet[0] == 'D') {
+            SendPacket(&conn, "OK");
+            break;
+        }
+        else if (packet[0] == 'H' || packet[0] == 'T') {
+            strcpy(reply, "OK");
+        }
+        else if (strncmp(packet, "qSupported", 10) == 0) {
+            sprintf(reply, "PacketSize=%x;QStartNoAckMode+", GDB_PACKET_SIZE);
+        }
+        else if (strcmp(packet, "QStartNoAckMode") == 0) {
+            SendPacket(&conn, "OK");
+            conn.noAck = 1;
+            continue;
+        }
+        else if (strcmp(packet, "qAttached") == 0) {
+            strcpy(reply, "1");
+        }
+        else if (strcmp(packet, "qfThreadInfo") == 0) {
+            strcpy(reply, "m1");
+        }
+        else if (strcmp(packet, "qsThreadInfo") == 0) {
+            strcpy(reply, "l");
+        }
+        //anything else is not supported, which gdb expects as an empty reply
+        if (SendPacket(&conn, reply) != 0) {
+            break;
+        }
+    }
+    close(conn.fd);
+    return 0;
+}
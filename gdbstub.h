@@ -0,0 +1,32 @@
+/*
+ * gdbstub.h: Declares a GDB remote serial protocol server for the simulator
+ *
+ * Registers are numbered R0-R7, PC (8) and PSR (9), 16 bits each. Memory is addressed in
+ * 16-bit words: the address and length of m, M and Z packets count words, not bytes.
+ * Register and memory values are sent most significant byte first, like object files.
+ */
+
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include "LC4.h"
+#include "events.h"
+
+// Largest packet the stub accepts or sends
+#define GDB_PACKET_SIZE 0x4000
+
+// Cycles run between checks for an interrupt from the debugger while continuing
+#define GDB_POLL_CYCLES 1000000
+
+/*
+ * Wait for a debugger on address - a TCP port on localhost, or else the path of a Unix
+ * socket. Returns the connection, or -1 if the socket can not be opened.
+ */
+int ListenGDB(char* address);
+
+/*
+ * Serve the debugger connected on fd until it detaches or kills the program, then close it.
+ */
+int ServeGDB(MachineState* CPU, FILE* output, EventState* events, int fd);
+
+#endif
@@ -1,35 +1,433 @@
 /*
  * loader.c : Defines loader functions for opening and loading object files
+ *
+ * Object files are loaded in two steps: ParseObjectFile reads a whole file at once and turns
+ * it into a list of code and data sections, then ApplyObjectImage copies each section into
+ * memory with one memcpy. LoadObjectFiles parses all files on the command line in parallel,
+ * checks them for overlaps and applies them in command-line order. Parsed images can be
+ * cached on disk, keyed by the real path, size and modification time of the object file.
  */
 
 #include "loader.h"
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-// memory array location
-unsigned short memoryAddress;
+#define CACHE_MAGIC "LC4C"
+#define CACHE_VERSION 1
+
+// Header of a cached image, followed by the path, the sections and the words
+typedef struct {
+  char magic[4];
+  unsigned int version;
+  long long mtime;
+  long long mtimeNsec;
+  long long size;
+  unsigned int pathLength;
+  unsigned int numSections;
+  unsigned int numWords;
+} CacheHeader;
+
+// Object files parsed by one loader thread
+typedef struct {
+  char** filenames;
+  ObjectImage* images;
+  int* results;
+  int first;
+  int count;
+  int stride;
+  char* cacheDir;
+} LoaderJob;
+
+// A section of one of the loaded files, for the overlap check
+typedef struct {
+  unsigned int start;
+  unsigned int end;
+  int file;
+} LoadedRange;
+
+//reads the big endian word at offset
+static unsigned short int ReadWord(unsigned char* data, long offset) {
+  return (data[offset] << 8u) | data[offset + 1];
+}
 
 /*
- * Read an object file and modify the machine state as described in the writeup
+ * Parse an object file into image, returns -1 if it can not be read or is malformed
  */
-int ReadObjectFile(char* filename, MachineState* CPU)
+int ParseObjectFile(char* filename, ObjectImage* image)
 {
   FILE *fp;   //file to be read
-  unsigned short int binary_instruction;
+  struct stat info;
+  memset(image, 0, sizeof(*image));
+  image->filename = filename;
   fp = fopen(filename, "rb");
+  if (fp == NULL || fstat(fileno(fp), &info) != 0) {
+    printf("error: could not open object file %s\n", filename);
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    return -1;
+  }
+  long size = info.st_size;
+  unsigned char* data = malloc(size + 1);
+  //every section is at least as big as its contents, so size / 2 words and size / 6 sections is enough
+  image->words = malloc((size / 2 + 1) * sizeof(unsigned short int));
+  image->sections = malloc((size / 6 + 1) * sizeof(ObjectSection));
+  if (data == NULL || image->words == NULL || image->sections == NULL) {
+    printf("error: out of memory loading %s\n", filename);
+    fclose(fp);
+    free(data);
+    return -1;
+  }
+  if (fread(data, 1, size, fp) != (size_t) size) {
+    printf("error: could not read object file %s\n", filename);
+    fclose(fp);
+    free(data);
+    return -1;
+  }
+  fclose(fp);
+
+  //walks the sections, symbol and debug sections are skipped over by their lengths
+  long offset = 0;
+  int status = 0;
+  while (offset + 2 <= size && status == 0) {
+    unsigned short int header = ReadWord(data, offset);
+    long needed = 0;
+    if (header == SECTION_CODE || header == SECTION_DATA || header == SECTION_SYMBOL) {
+      needed = 6;
+    }
+    else if (header == SECTION_FILE) {
+      needed = 4;
+    }
+    else if (header == SECTION_LINE) {
+      needed = 8;
+    }
+    else {
+      printf("error: unknown section x%04X at byte %ld of %s\n", header, offset, filename);
+      free(data);
+      return -1;
+    }
+    if (offset + needed > size) {
+      status = -1;
+      break;
+    }
+    if (header == SECTION_CODE || header == SECTION_DATA) {
+      ObjectSection* section = &image->sections[image->numSections];
+      section->kind = header;
+      section->address = ReadWord(data, offset + 2);
+      section->length = ReadWord(data, offset + 4);
+      section->offset = image->numWords;
+      offset += 6;
+      if (offset + 2 * (long) section->length > size) {
+        status = -1;
+        break;
+      }
+      if (section->address + section->length > 65536) {
+        printf("error: the section at x%04X in %s exceeds the memory of the system\n", section->address, filename);
+        free(data);
+        return -1;
+      }
+      for (unsigned int i = 0; i < section->length; i++) {
+        image->words[image->numWords++] = ReadWord(data, offset + 2 * i);
+      }
+      offset += 2 * section->length;
+      image->numSections++;
+    }
+    else if (header == SECTION_SYMBOL) {
+      //address, then a name of n bytes
+      offset += 6 + ReadWord(data, offset + 4);
+    }
+    else if (header == SECTION_FILE) {
+      offset += 4 + ReadWord(data, offset + 2);
+    }
+    else {
+      //address, line and file index
+      offset += 8;
+    }
+  }
+  if (status == 0 && offset != size) {
+    status = -1;
+  }
+  if (status != 0) {
+    printf("error: object file %s is truncated or malformed\n", filename);
+  }
+  free(data);
+  return status;
+}
+
+
+/*
+ * Copy the sections of image into memory
+ */
+void ApplyObjectImage(ObjectImage* image, MachineState* CPU)
+{
+  for (int i = 0; i < image->numSections; i++) {
+    ObjectSection* section = &image->sections[i];
+    memcpy(&CPU->memory[section->address], &image->words[section->offset], section->length * sizeof(unsigned short int));
+  }
+}
+
+
+void FreeObjectImage(ObjectImage* image)
+{
+  free(image->sections);
+  free(image->words);
+  image->sections = NULL;
+  image->words = NULL;
+}
+
+
+/*
+ * Read an object file and modify the machine state as described in the writeup
+ */
+int ReadObjectFile(char* filename, MachineState* CPU)
+{
+  ObjectImage image;
+  if (ParseObjectFile(filename, &image) != 0) {
+    FreeObjectImage(&image);
+    return -1;
+  }
+  ApplyObjectImage(&image, CPU);
+  FreeObjectImage(&image);
+  return 0;
+}
+
+
+//fills in the cache header for filename and returns the name of its cache file, or -1 if it has none
+static int CacheName(char* cacheDir, char* filename, CacheHeader* header, char* path, char* name)
+{
+  struct stat info;
+  if (realpath(filename, path) == NULL || stat(path, &info) != 0) {
+    return -1;
+  }
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, CACHE_MAGIC, 4);
+  header->version = CACHE_VERSION;
+  header->mtime = info.st_mtim.tv_sec;
+  header->mtimeNsec = info.st_mtim.tv_nsec;
+  header->size = info.st_size;
+  header->pathLength = strlen(path);
+  //FNV-1a hash of the path
+  unsigned long long hash = 0xCBF29CE484222325ull;
+  for (char* c = path; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 0x100000001B3ull;
+  }
+  snprintf(name, PATH_MAX, "%s/%016llx.lc4c", cacheDir, hash);
+  return 0;
+}
+
+//loads image from the cache, returns -1 if it is missing or out of date
+static int ReadCache(char* name, CacheHeader* expected, char* path, ObjectImage* image)
+{
+  CacheHeader header;
+  char cachedPath[PATH_MAX];
+  FILE* fp = fopen(name, "rb");
   if (fp == NULL) {
-    printf("error: the file could not be opened\n");
     return -1;
   }
-  while(!feof(fp)) {
-    fread(&binary_instruction, sizeof(binary_instruction), 1, fp);
-    binary_instruction = swap_endian(binary_instruction);
-    if (binary_instruction == 0xCADE || binary_instruction == 0xDADA) {
-      parse_code(CPU, fp);
+  int status = -1;
+  if (fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, expected->magic, 4) == 0 &&
+      header.version == expected->version && header.mtime == expected->mtime &&
+      header.mtimeNsec == expected->mtimeNsec && header.size == expected->size &&
+      header.pathLength == expected->pathLength && header.pathLength < PATH_MAX &&
+      header.numSections <= header.size / 6 && header.numWords <= header.size / 2 &&
+      fread(cachedPath, 1, header.pathLength, fp) == header.pathLength &&
+      memcmp(cachedPath, path, header.pathLength) == 0) {
+    image->numSections = header.numSections;
+    image->numWords = header.numWords;
+    image->sections = malloc((header.numSections + 1) * sizeof(ObjectSection));
+    image->words = malloc((header.numWords + 1) * sizeof(unsigned short int));
+    if (image->sections != NULL && image->words != NULL &&
+        fread(image->sections, sizeof(ObjectSection), header.numSections, fp) == header.numSections &&
+        fread(image->words, sizeof(unsigned short int), header.numWords, fp) == header.numWords) {
+      status = 0;
+    }
+    //a damaged cache file must not load outside of memory
+    for (unsigned int i = 0; status == 0 && i < header.numSections; i++) {
+      ObjectSection* section = &image->sections[i];
+      if (section->offset + section->length > header.numWords || section->address + section->length > 65536) {
+        status = -1;
+      }
     }
   }
   fclose(fp);
+  return status;
+}
+
+//saves image to the cache, through a temporary file so other runs never see half of it
+static void WriteCache(char* name, CacheHeader* header, char* path, ObjectImage* image, int index)
+{
+  char temp[PATH_MAX + 32];
+  snprintf(temp, sizeof(temp), "%s.%d.%d.tmp", name, (int) getpid(), index);
+  FILE* fp = fopen(temp, "wb");
+  if (fp == NULL) {
+    return;
+  }
+  header->numSections = image->numSections;
+  header->numWords = image->numWords;
+  int ok = fwrite(header, sizeof(*header), 1, fp) == 1 &&
+           fwrite(path, 1, header->pathLength, fp) == header->pathLength &&
+           fwrite(image->sections, sizeof(ObjectSection), image->numSections, fp) == (size_t) image->numSections &&
+           fwrite(image->words, sizeof(unsigned short int), image->numWords, fp) == image->numWords;
+  if (fclose(fp) != 0 || !ok || rename(temp, name) != 0) {
+    remove(temp);
+  }
+}
+
+//parses an object file, going through the cache if there is one
+static int LoadImage(char* filename, ObjectImage* image, char* cacheDir, int index)
+{
+  CacheHeader header;
+  char path[PATH_MAX];
+  char name[PATH_MAX];
+  if (cacheDir == NULL || CacheName(cacheDir, filename, &header, path, name) != 0) {
+    return ParseObjectFile(filename, image);
+  }
+  memset(image, 0, sizeof(*image));
+  image->filename = filename;
+  if (ReadCache(name, &header, path, image) == 0) {
+    return 0;
+  }
+  FreeObjectImage(image);
+  if (ParseObjectFile(filename, image) != 0) {
+    return -1;
+  }
+  WriteCache(name, &header, path, image, index);
   return 0;
 }
 
+static void* LoaderThread(void* arg)
+{
+  LoaderJob* job = (LoaderJob*) arg;
+  for (int i = job->first; i < job->count; i += job->stride) {
+    job->results[i] = LoadImage(job->filenames[i], &job->images[i], job->cacheDir, i);
+  }
+  return NULL;
+}
+
+static int CompareRanges(const void* a, const void* b)
+{
+  const LoadedRange* x = a;
+  const LoadedRange* y = b;
+  if (x->start != y->start) {
+    return (x->start < y->start) ? -1 : 1;
+  }
+  return x->file - y->file;
+}
+
+//reports sections that load over each other, returns how many overlaps there are
+static int ReportOverlaps(ObjectImage* images, int count)
+{
+  int numRanges = 0, overlaps = 0;
+  for (int i = 0; i < count; i++) {
+    numRanges += images[i].numSections;
+  }
+  LoadedRange* ranges = malloc((numRanges + 1) * sizeof(LoadedRange));
+  int* active = malloc((numRanges + 1) * sizeof(int));
+  if (ranges == NULL || active == NULL) {
+    free(ranges);
+    free(active);
+    return 0;
+  }
+  numRanges = 0;
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < images[i].numSections; j++) {
+      if (images[i].sections[j].length > 0) {
+        ranges[numRanges].start = images[i].sections[j].address;
+        ranges[numRanges].end = images[i].sections[j].address + images[i].sections[j].length;
+        ranges[numRanges].file = i;
+        numRanges++;
+      }
+    }
+  }
+  qsort(ranges, numRanges, sizeof(LoadedRange), CompareRanges);
+  //sweeps the ranges by start, keeping every earlier range that still reaches the current one
+  int numActive = 0;
+  for (int i = 0; i < numRanges; i++) {
+    int kept = 0;
+    for (int k = 0; k < numActive; k++) {
+      LoadedRange* other = &ranges[active[k]];
+      if (other->end <= ranges[i].start) {
+        continue;
+      }
+      unsigned int end = (ranges[i].end < other->end) ? ranges[i].end : other->end;
+      printf("warning: x%04X-x%04X is loaded by both %s and %s\n", ranges[i].start, end - 1,
+             images[other->file].filename, images[ranges[i].file].filename);
+      overlaps++;
+      active[kept++] = active[k];
+    }
+    active[kept++] = i;
+    numActive = kept;
+  }
+  free(ranges);
+  free(active);
+  return overlaps;
+}
+
+
+/*
+ * Parse the object files in parallel, report overlaps and load them in command-line order
+ */
+int LoadObjectFiles(char** filenames, int count, MachineState* CPU, char* cacheDir)
+{
+  int threads = (count < LOADER_THREADS) ? count : LOADER_THREADS;
+  ObjectImage* images = calloc(count, sizeof(ObjectImage));
+  int* results = calloc(count, sizeof(int));
+  LoaderJob* jobs = calloc(threads, sizeof(LoaderJob));
+  pthread_t* ids = calloc(threads, sizeof(pthread_t));
+  int status = 0;
+  if (images == NULL || results == NULL || jobs == NULL || ids == NULL) {
+    printf("error: out of memory\n");
+    return -1;
+  }
+  //the first share of the files is parsed on this thread
+  for (int t = 0; t < threads; t++) {
+    jobs[t].filenames = filenames;
+    jobs[t].images = images;
+    jobs[t].results = results;
+    jobs[t].first = t;
+    jobs[t].count = count;
+    jobs[t].stride = threads;
+    jobs[t].cacheDir = cacheDir;
+  }
+  int started = 1;
+  for (; started < threads; started++) {
+    if (pthread_create(&ids[started], NULL, LoaderThread, &jobs[started]) != 0) {
+      break;
+    }
+  }
+  //files of threads that could not be started are parsed here
+  for (int t = 0; t < threads; t++) {
+    if (t == 0 || t >= started) {
+      LoaderThread(&jobs[t]);
+    }
+  }
+  for (int t = 1; t < started; t++) {
+    pthread_join(ids[t], NULL);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (results[i] != 0) {
+      status = -1;
+    }
+  }
+  if (status == 0) {
+    ReportOverlaps(images, count);
+    for (int i = 0; i < count; i++) {
+      ApplyObjectImage(&images[i], CPU);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    FreeObjectImage(&images[i]);
+  }
+  free(images);
+  free(results);
+  free(jobs);
+  free(ids);
+  return status;
+}
+
 
 unsigned short int swap_endian (unsigned short int instruction) {
   unsigned short int temp = instruction;
@@ -41,25 +439,6 @@ unsigned short int swap_endian (unsigned short int instruction) {
   return s0 + s1 + s2 + s3;
 }
 
-int parse_code (MachineState* CPU, FILE *fp) {
-  unsigned short int addr, amt_of_data, current_data;
-  fread(&addr, sizeof(addr), 1, fp);
-  fread(&amt_of_data, sizeof(amt_of_data), 1, fp);
-  addr = swap_endian(addr);
-  amt_of_data = swap_endian (amt_of_data);
-  for (int i = 0; i < amt_of_data; i++) {
-    if (addr > 65535) {
-      printf("error: the address specified exceeds the memory of the system\n");
-      return -1;
-    }
-    fread(&current_data, sizeof(current_data), 1, fp);
-    current_data = swap_endian(current_data);
-    CPU -> memory[addr] = current_data;
-    addr++;
-  }
-  return 0;
-}
-
 int write_to_file(MachineState* CPU, char* filename) {
   FILE *fp;
   fp = fopen(filename, "w");
@@ -78,4 +457,3 @@ int write_to_file(MachineState* CPU, char* filename) {
   fclose(fp);
   return 0;
 }
-
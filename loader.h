@@ -2,11 +2,55 @@
  * loader.h: Declares loader functions for opening and loading object files
  */
 
+#ifndef LOADER_H
+#define LOADER_H
+
 #include <stdio.h>
 #include "LC4.h"
 
+// Section headers of an object file
+#define SECTION_CODE    0xCADE
+#define SECTION_DATA    0xDADA
+#define SECTION_SYMBOL  0xC3B7
+#define SECTION_FILE    0xF17E
+#define SECTION_LINE    0x715E
+
+// Most object files parsed at the same time
+#define LOADER_THREADS 8
+
+// A code or data section, its words are at offset in the image's words
+typedef struct {
+  unsigned short int kind;
+  unsigned short int address;
+  unsigned int length;
+  unsigned int offset;
+} ObjectSection;
+
+// The code and data sections of one object file, ready to be copied into memory
+typedef struct {
+  char* filename;
+  int numSections;
+  ObjectSection* sections;
+  unsigned int numWords;
+  unsigned short int* words;
+} ObjectImage;
+
 // Read an object file and modify the machine state as described in the writeup
 int ReadObjectFile(char* filename, MachineState* CPU);
+
+/*
+ * Parse the object files in parallel, report sections that overlap and load them in order,
+ * so later files overwrite earlier ones. Parsed images are cached in cacheDir unless it is
+ * NULL. Returns -1 on error.
+ */
+int LoadObjectFiles(char** filenames, int count, MachineState* CPU, char* cacheDir);
+
+// Parse an object file into image, returns -1 if it can not be read or is malformed
+int ParseObjectFile(char* filename, ObjectImage* image);
+void ApplyObjectImage(ObjectImage* image, MachineState* CPU);
+void FreeObjectImage(ObjectImage* image);
+
 unsigned short int swap_endian(unsigned short int instruction);
-int parse_code (MachineState* CPU, FILE *fp);
-int write_to_file(MachineState* CPU, char* filename);
\ No newline at end of file
+int write_to_file(MachineState* CPU, char* filename);
+
+#endif
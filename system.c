@@ -0,0 +1,255 @@
+/*
+ * system.c: Defines multi-core LC4 systems
+ *
+ * Each core is an ordinary MachineState whose memory points at the shared image, run by
+ * RunMachine a quantum at a time: the quantum is just a cycle limit, so a core runs at full
+ * speed between synchronizations. After every quantum the cores meet at a barrier, which
+ * keeps them within a quantum of each other.
+ *
+ * Loads and stores to shared memory are relaxed host atomics, so cores never race on a word,
+ * but a store by one core is only guaranteed to be seen by the others after the next
+ * barrier. Lock and mailbox words are read-modify-write atomics with acquire and release
+ * ordering and are seen at once. Instruction fetches are plain loads: code must not be
+ * changed while another core may be running it.
+ */
+
+#include "system.h"
+
+typedef struct {
+    SystemState* system;
+    int core;
+    FILE* output;
+} CoreThread;
+
+static void SetBit(unsigned char* map, unsigned short int address)
+{
+    map[address >> 3u] |= 1u << (address & 7u);
+}
+
+//runs a core for up to a quantum, returns STOP_NONE if it is still running after it
+static int RunQuantum(SystemState* system, int core, FILE* output)
+{
+    CoreState* state = &system->cores[core];
+    EventState* events = &state->events;
+    unsigned long long cycles = system->quantum;
+    unsigned long long start = events->cycles;
+    if (state->limit != NO_CYCLE_LIMIT && state->limit < cycles) {
+        cycles = state->limit;
+    }
+    SetCycleLimit(events, cycles);
+    int reason = RunMachine(&state->machine, output, events);
+    if (state->limit != NO_CYCLE_LIMIT) {
+        state->limit -= events->cycles - start;
+    }
+    //the end of the quantum, rather than of the cycles the core was given
+    if (reason == STOP_CYCLE_LIMIT && state->limit != 0) {
+        return STOP_NONE;
+    }
+    return reason;
+}
+
+//waits for all running cores to finish the quantum
+static void WaitQuantum(SystemState* system)
+{
+    pthread_mutex_lock(&system->mutex);
+    unsigned long long generation = system->generation;
+    if (++system->arrived == system->running) {
+        system->arrived = 0;
+        system->generation++;
+        pthread_cond_broadcast(&system->cond);
+    }
+    else {
+        while (generation == system->generation) {
+            pthread_cond_wait(&system->cond, &system->mutex);
+        }
+    }
+    pthread_mutex_unlock(&system->mutex);
+}
+
+//takes a stopped core out of the barrier, releasing the others if they were only waiting for it
+static void LeaveQuantum(SystemState* system)
+{
+    pthread_mutex_lock(&system->mutex);
+    system->running--;
+    if (system->arrived > 0 && system->arrived == system->running) {
+        system->arrived = 0;
+        system->generation++;
+        pthread_cond_broadcast(&system->cond);
+    }
+    pthread_mutex_unlock(&system->mutex);
+}
+
+static void* RunCore(void* arg)
+{
+    CoreThread* thread = (CoreThread*) arg;
+    SystemState* system = thread->system;
+    int reason;
+    //once there are threads every fprintf locks its stream, holding the lock for the quantum
+    //makes those locks cheap
+    while (1) {
+        if (thread->output != NULL) {
+            flockfile(thread->output);
+        }
+        reason = RunQuantum(system, thread->core, thread->output);
+        if (thread->output != NULL) {
+            funlockfile(thread->output);
+        }
+        if (reason != STOP_NONE) {
+            break;
+        }
+        WaitQuantum(system);
+    }
+    system->cores[thread->core].reason = reason;
+    LeaveQuantum(system);
+    return NULL;
+}
+
+
+/*
+ * Set up an empty system with the default quantum.
+ */
+void InitSystem(SystemState* system)
+{
+    memset(system, 0, sizeof(*system));
+    system->quantum = DEFAULT_QUANTUM;
+}
+
+
+/*
+ * Make address an ATOMIC_LOCK or ATOMIC_MAILBOX word.
+ */
+void AddAtomicWord(SystemState* system, unsigned short int address, int kind)
+{
+    if (!EVENT_TEST(system->atomicMap, address)) {
+        system->numAtomic++;
+    }
+    SetBit((kind == ATOMIC_LOCK) ? system->lockMap : system->mailboxMap, address);
+    SetBit(system->atomicMap, address);
+}
+
+
+/*
+ * Create numCores cores sharing memory.
+ */
+int CreateCores(SystemState* system, int numCores, unsigned short int* memory, EventState* events)
+{
+    if (numCores < 1 || numCores > MAX_CORES) {
+        printf("error: a system has from 1 to %d cores\n", MAX_CORES);
+        return -1;
+    }
+    system->numCores = numCores;
+    system->memory = memory;
+    //a core per cache line, so one core's registers never share a line with another's pointers
+    system->cores = aligned_alloc(CACHE_LINE, numCores * sizeof(CoreState));
+    if (system->cores == NULL) {
+        printf("error: out of memory\n");
+        return -1;
+    }
+    memset(system->cores, 0, numCores * sizeof(CoreState));
+    for (int i = 0; i < numCores; i++) {
+        CoreState* state = &system->cores[i];
+        MachineState* core = &state->machine;
+        core->PC = 0x8200;
+        core->PSR = 0x8002;
+        core->R[0] = i;
+        core->memory = memory;
+        core->system = system;
+        //filters keep sampling state, so every core needs its own
+        memcpy(&state->events, events, sizeof(EventState));
+        if (events->filter != NULL) {
+            memcpy(&state->filter, events->filter, sizeof(TraceFilter));
+            state->events.filter = &state->filter;
+        }
+        state->limit = events->limit;
+        state->reason = STOP_NONE;
+    }
+    return 0;
+}
+
+
+/*
+ * Run all cores until each of them stops.
+ */
+int RunSystem(SystemState* system, FILE** outputs)
+{
+    int n = system->numCores;
+    if (system->quantum == 0) {
+        system->quantum = 1;
+    }
+    //round robin on this thread, so every run interleaves the cores the same way
+    if (system->deterministic) {
+        int running = n;
+        while (running > 0) {
+            for (int i = 0; i < n; i++) {
+                if (system->cores[i].reason == STOP_NONE) {
+                    system->cores[i].reason = RunQuantum(system, i, outputs[i]);
+                    running -= (system->cores[i].reason != STOP_NONE);
+                }
+            }
+        }
+        return 0;
+    }
+
+    pthread_t* threads = malloc(n * sizeof(pthread_t));
+    CoreThread* args = malloc(n * sizeof(CoreThread));
+    if (threads == NULL || args == NULL) {
+        printf("error: out of memory\n");
+        return -1;
+    }
+    pthread_mutex_init(&system->mutex, NULL);
+    pthread_cond_init(&system->cond, NULL);
+    system->running = n;
+    system->arrived = 0;
+    int started = 0;
+    for (; started < n; started++) {
+        args[started].system = system;
+        args[started].core = started;
+        args[started].output = outputs[started];
+        if (pthread_create(&threads[started], NULL, RunCore, &args[started]) != 0) {
+            break;
+        }
+    }
+    //cores that could not be started must not hold up the barrier
+    for (int i = started; i < n; i++) {
+        system->cores[i].reason = STOP_ERROR;
+        LeaveQuantum(system);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&system->cond);
+    pthread_mutex_destroy(&system->mutex);
+    free(threads);
+    free(args);
+    if (started < n) {
+        printf("error: could not start core %d\n", started);
+        return -1;
+    }
+    return 0;
+}
+
+
+void FreeSystem(SystemState* system)
+{
+    free(system->cores);
+    system->cores = NULL;
+}
+
+
+/*
+ * Called by LoadOp for atomic words: a lock is test-and-set, a mailbox is read-and-clear.
+ */
+unsigned short int AtomicLoad(SystemState* system, unsigned short int address)
+{
+    unsigned short int value = EVENT_TEST(system->lockMap, address) ? 1 : 0;
+    return __atomic_exchange_n(&system->memory[address], value, __ATOMIC_ACQ_REL);
+}
+
+
+/*
+ * Called by StoreOp for atomic words.
+ */
+void AtomicStore(SystemState* system, unsigned short int address, unsigned short int value)
+{
+    __atomic_store_n(&system->memory[address], value, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,104 @@
+/*
+ * system.h: Declares multi-core LC4 systems, where every core runs on its own host thread
+ * and all of them share one memory
+ */
+
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include <pthread.h>
+#include "LC4.h"
+#include "events.h"
+
+#define MAX_CORES 64
+
+// Cycles each core runs between synchronizations
+#define DEFAULT_QUANTUM 1000
+
+// Cores are kept on cache lines of their own, their threads write them on every instruction
+#define CACHE_LINE 64
+
+// Kinds of atomic word
+#define ATOMIC_LOCK     1
+#define ATOMIC_MAILBOX  2
+
+// Everything one core's thread writes while it runs
+typedef struct {
+    MachineState machine;
+
+    // stop conditions and trace filter, copied from the ones the system was built from
+    EventState events;
+    TraceFilter filter;
+
+    // STOP_* reason, STOP_NONE while the core is running
+    int reason;
+
+    // cycles left before STOP_CYCLE_LIMIT, or NO_CYCLE_LIMIT
+    unsigned long long limit;
+} __attribute__((aligned(CACHE_LINE))) CoreState;
+
+struct SystemState {
+    int numCores;
+    CoreState* cores;
+
+    // memory shared by all of the cores
+    unsigned short int* memory;
+
+    // a load from a lock word sets it to 1 and a load from a mailbox word clears it, both
+    // return the old value; atomicMap = lockMap | mailboxMap is the only map LoadOp and
+    // StoreOp test
+    unsigned char lockMap[EVENT_MAP_SIZE];
+    unsigned char mailboxMap[EVENT_MAP_SIZE];
+    unsigned char atomicMap[EVENT_MAP_SIZE];
+    int numAtomic;
+
+    // no core runs more than a quantum ahead of the others; a deterministic system runs the
+    // cores round robin on the calling thread, a quantum at a time
+    unsigned long long quantum;
+    int deterministic;
+
+    // the barrier the cores meet at after every quantum
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int running;
+    int arrived;
+    unsigned long long generation;
+};
+
+
+/*
+ * Set up an empty system with the default quantum.
+ */
+void InitSystem(SystemState* system);
+
+
+/*
+ * Make address an ATOMIC_LOCK or ATOMIC_MAILBOX word.
+ */
+void AddAtomicWord(SystemState* system, unsigned short int address, int kind);
+
+
+/*
+ * Create numCores cores sharing memory, all reset to x8200 with R0 holding the number of the
+ * core. Each core gets its own copy of events and its filter. Returns -1 on error.
+ */
+int CreateCores(SystemState* system, int numCores, unsigned short int* memory, EventState* events);
+
+
+/*
+ * Run all cores until each of them stops, core n writing its trace to outputs[n]. The
+ * reason each core stopped is left in system->cores[n].reason. Returns -1 on error.
+ */
+int RunSystem(SystemState* system, FILE** outputs);
+
+
+void FreeSystem(SystemState* system);
+
+
+/*
+ * Called by LoadOp and StoreOp for atomic words.
+ */
+unsigned short int AtomicLoad(SystemState* system, unsigned short int address);
+void AtomicStore(SystemState* system, unsigned short int address, unsigned short int value);
+
+#endif
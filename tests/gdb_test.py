@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""
+gdb_test.py: drives trace -gdb with a scripted remote serial protocol client
+
+usage: gdb_test.py path/to/trace
+
+Runs tests/gdb.obj, which holds the usual boot code at x8200 and this user program:
+
+    x0000  CONST R2, #0
+    x0001  HICONST R2, #64      ; R2 = x4000
+    x0002  CONST R3, #5
+    x0003  STR R3, R2, #1       ; x4001 = 5
+    x0004  LDR R1, R2, #0       ; spins while x4000 is not zero
+    x0005  BRnp #-2
+    x0006  TRAP xFF             ; halts at x80FF
+
+x4000 starts at 1, so the program only halts once the client has cleared it.
+"""
+
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+class Client:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX)
+        for _ in range(100):
+            try:
+                self.sock.connect(path)
+                break
+            except OSError:
+                time.sleep(0.05)
+        else:
+            raise RuntimeError("trace never opened " + path)
+        self.buffer = b""
+
+    def read_packet(self):
+        while b"#" not in self.buffer or len(self.buffer) < self.buffer.index(b"#") + 3:
+            data = self.sock.recv(4096)
+            if not data:
+                raise RuntimeError("connection closed")
+            self.buffer += data
+        start = self.buffer.index(b"$")
+        end = self.buffer.index(b"#")
+        assert self.buffer[:start].strip(b"+") == b"", self.buffer
+        body = self.buffer[start + 1:end]
+        assert int(self.buffer[end + 1:end + 3], 16) == sum(body) & 0xFF, "bad checksum"
+        self.buffer = self.buffer[end + 3:]
+        self.sock.sendall(b"+")
+        return body.decode()
+
+    def send(self, command):
+        self.sock.sendall(b"$%s#%02x" % (command.encode(), sum(command.encode()) & 0xFF))
+        return self.read_packet()
+
+
+def expect(client, command, reply):
+    got = client.send(command)
+    if got != reply:
+        raise AssertionError("%s: expected %r, got %r" % (command, reply, got))
+
+
+# commands and the replies they must get, in order
+SCRIPT = [
+    ("?", "S05"),
+    # registers R0-R7, PC and PSR
+    ("g", "0000" * 8 + "8200" + "8002"),
+    ("p8", "8200"),
+    # memory is addressed and counted in words
+    ("m0,7", "9400d5409605768162800bfef0ff"),
+    ("m4000,2", "00010000"),
+    # breakpoint, then a single step
+    ("Z0,2,2", "OK"),
+    ("c", "S05"),
+    ("p8", "0002"),
+    ("s", "S05"),
+    ("p8", "0003"),
+    ("z0,2,2", "OK"),
+    # the write watchpoint stops after the store
+    ("Z2,4001,1", "OK"),
+    ("c", "T05watch:4001;"),
+    ("p8", "0004"),
+    ("m4001,1", "0005"),
+    ("z2,4001,1", "OK"),
+    ("Z3,4000,1", "OK"),
+    ("c", "T05rwatch:4000;"),
+    ("p1", "0001"),
+    ("z3,4000,1", "OK"),
+    # an access watchpoint is reported as awatch, whether the word is read or written
+    ("Z4,4000,1", "OK"),
+    ("c", "T05awatch:4000;"),
+    ("z4,4000,1", "OK"),
+]
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: gdb_test.py path/to/trace")
+        return 1
+    with tempfile.TemporaryDirectory() as tmp:
+        sock = os.path.join(tmp, "gdb.sock")
+        out = os.path.join(tmp, "out.txt")
+        proc = subprocess.Popen([sys.argv[1], "-gdb", sock, out, os.path.join(HERE, "gdb.obj")],
+                                stdout=subprocess.DEVNULL)
+        try:
+            client = Client(sock)
+            assert "PacketSize" in client.send("qSupported:multiprocess+")
+            for command, reply in SCRIPT:
+                expect(client, command, reply)
+            # the program spins on x4000 until it is interrupted
+            client.sock.sendall(b"$c#63")
+            time.sleep(0.3)
+            client.sock.sendall(b"\x03")
+            got = client.read_packet()
+            if got != "S02":
+                raise AssertionError("^C: expected 'S02', got %r" % got)
+            # clearing x4000 lets it run to the halt
+            expect(client, "M4000,1:0000", "OK")
+            expect(client, "c", "W00")
+            # gdb disconnects once the program has exited
+            client.sock.close()
+            if proc.wait(timeout=10) != 0:
+                raise AssertionError("trace exited with %d" % proc.returncode)
+            with open(out) as trace:
+                last = trace.read().splitlines()[-1]
+            if not last.startswith("0006 "):
+                raise AssertionError("trace does not end at the TRAP: %r" % last)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+        # a socket that can not be opened is an error, and leaves no trace behind
+        out = os.path.join(tmp, "bad.txt")
+        status = subprocess.run([sys.argv[1], "-gdb", os.path.join(tmp, "missing", "gdb.sock"), out,
+                                 os.path.join(HERE, "gdb.obj")], stdout=subprocess.DEVNULL).returncode
+        if status == 0:
+            raise AssertionError("trace exited with 0 on a bad gdb socket")
+        if os.path.exists(out):
+            raise AssertionError("trace left %s behind on a bad gdb socket" % out)
+    print("gdb_test: ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
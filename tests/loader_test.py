@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+loader_test.py: checks how trace loads object files
+
+usage: loader_test.py path/to/trace
+
+tests/loader.obj holds every kind of section, in this order:
+
+    byte  0  CADE x8200, 2 words     the usual boot code
+    byte 10  C3B7 x0000, "start"     a symbol with a name of odd length
+    byte 21  F17E "user.c"           a file name
+    byte 31  CADE x0000, 6 words     CONST R2,#0; HICONST R2,#64; LDR R1,R2,#0;
+                                     ADDI R1,R1,#1; STR R1,R2,#1; TRAP xFF
+    byte 49  715E x0002, line 3, file 0
+    byte 57  DADA x4000, 1 word      x1233
+    byte 65  end
+
+The program loads x1233 from x4000 and stores x1234 to x4001, which only happens if the symbol,
+file and line sections are skipped without losing track of the code and data around them.
+"""
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FIXTURE = os.path.join(HERE, "loader.obj")
+
+# where each section of loader.obj starts, and its end
+BOUNDARIES = [0, 10, 21, 31, 49, 57, 65]
+
+
+def run(trace, out, *objects):
+    result = subprocess.run([trace, "-cycles", "20", out] + list(objects),
+                            stdout=subprocess.PIPE, universal_newlines=True)
+    return result.returncode, result.stdout
+
+
+def expect(what, expected, got):
+    if got != expected:
+        raise AssertionError("%s: expected %r, got %r" % (what, expected, got))
+
+
+def write(tmp, name, data):
+    path = os.path.join(tmp, name)
+    with open(path, "wb") as obj:
+        obj.write(data)
+    return path
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: loader_test.py path/to/trace")
+        return 1
+    trace = sys.argv[1]
+    with open(FIXTURE, "rb") as obj:
+        fixture = obj.read()
+    expect("fixture size", BOUNDARIES[-1], len(fixture))
+    with tempfile.TemporaryDirectory() as tmp:
+        out = os.path.join(tmp, "out.txt")
+
+        # the program runs as written
+        status, _ = run(trace, out, FIXTURE)
+        expect("exit status", 0, status)
+        with open(out) as lines:
+            fields = [line.split() for line in lines]
+        expect("PCs", ["8200", "8201", "0000", "0001", "0002", "0003", "0004", "0005"],
+               [f[0] for f in fields])
+        expect("load", ["4000", "1233"], fields[4][8:10])
+        expect("store", ["4001", "1234"], fields[6][8:10])
+
+        # a file cut inside a section is rejected, one cut between sections is not
+        for size in range(1, len(fixture)):
+            path = write(tmp, "cut%d.obj" % size, fixture[:size])
+            status, text = run(trace, out, path)
+            if size in BOUNDARIES:
+                if status != 0 or "error" in text:
+                    raise AssertionError("file cut at byte %d was rejected: %r" % (size, text))
+            elif status == 0 or "truncated or malformed" not in text:
+                raise AssertionError("file cut at byte %d was accepted: %r" % (size, text))
+
+        # so is an unknown section header
+        path = write(tmp, "unknown.obj", fixture + struct.pack(">HHH", 0xBEEF, 0x0000, 0))
+        status, text = run(trace, out, path)
+        if status == 0 or "unknown section xBEEF at byte 65" not in text:
+            raise AssertionError("unknown section was accepted: %r" % text)
+
+        # and a section that runs off the end of memory
+        path = write(tmp, "wrap.obj", fixture + struct.pack(">HHHHH", 0xDADA, 0xFFFF, 2, 1, 2))
+        status, text = run(trace, out, path)
+        if status == 0 or "exceeds the memory" not in text:
+            raise AssertionError("section past xFFFF was accepted: %r" % text)
+
+        # every pair of files loading the same words is reported, not just neighbours
+        gdb = os.path.join(HERE, "gdb.obj")
+        counter = os.path.join(HERE, "counter.obj")
+        status, text = run(trace, out, gdb, counter, FIXTURE)
+        expect("exit status with overlaps", 0, status)
+        warnings = sorted(line for line in text.splitlines() if line.startswith("warning:"))
+        expected = []
+        for start, end, pairs in [("x0000", "x0006", [(gdb, counter)]),
+                                  ("x0000", "x0005", [(gdb, FIXTURE), (counter, FIXTURE)]),
+                                  ("x4000", "x4000", [(gdb, FIXTURE)]),
+                                  ("x8200", "x8201", [(gdb, counter), (gdb, FIXTURE), (counter, FIXTURE)])]:
+            for first, second in pairs:
+                expected.append("warning: %s-%s is loaded by both %s and %s" % (start, end, first, second))
+        expect("overlap warnings", sorted(expected), warnings)
+    print("loader_test: ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+system_test.py: checks the shared memory and atomic words of trace -cores
+
+usage: system_test.py path/to/trace
+
+Runs tests/counter.obj, which holds the usual boot code at x8200 and this user program:
+
+    x0000  CONST R2, #0
+    x0001  HICONST R2, #64      ; R2 = x4000
+    x0002  CONST R4, #100
+    x0003  LDR R3, R2, #1       ; spins until the lock at x4001 is taken
+    x0004  BRp #-2
+    x0005  LDR R5, R2, #0       ; x4000 = x4000 + 1
+    x0006  ADDI R5, R5, #1
+    x0007  STR R5, R2, #0
+    x0008  CONST R6, #0
+    x0009  STR R6, R2, #1       ; releases the lock
+    x000A  ADD R6, R2, R0
+    x000B  STR R4, R6, #16      ; x4010 + core = iterations left
+    x000C  ADDI R4, R4, #-1
+    x000D  BRp #-11
+    x000E  TRAP xFF
+
+Every core adds 100 to the counter at x4000, so four cores must leave it at 400 when x4001 is
+a lock word.
+"""
+
+import filecmp
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORES = 4
+
+
+def run(trace, tmp, name, *options):
+    out = os.path.join(tmp, name + ".txt")
+    subprocess.run([trace, "-cores", str(CORES)] + list(options) +
+                   [out, os.path.join(HERE, "counter.obj")],
+                   stdout=subprocess.DEVNULL, check=True)
+    return [os.path.join(tmp, "%s.core%d.txt" % (name, i)) for i in range(CORES)]
+
+
+def stores(files, address):
+    """the values stored to address, in the order each core stored them"""
+    values = []
+    for path in files:
+        with open(path) as trace:
+            for line in trace:
+                fields = line.split()
+                if fields[1].startswith("0111") and fields[8] == address:
+                    values.append(int(fields[9], 16))
+    return values
+
+
+def expect(what, expected, got):
+    if got != expected:
+        raise AssertionError("%s: expected %r, got %r" % (what, expected, got))
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: system_test.py path/to/trace")
+        return 1
+    trace = sys.argv[1]
+    with tempfile.TemporaryDirectory() as tmp:
+        # the lock keeps every increment, so the counter ends at 4 * 100
+        files = run(trace, tmp, "lock", "-lock", "x4001")
+        counts = stores(files, "4000")
+        expect("locked counter", 400, max(counts))
+        expect("locked increments", list(range(1, 401)), sorted(counts))
+        # R0 holds the core number, so each core counts down in its own word
+        for i, path in enumerate(files):
+            expect("core %d countdown" % i, list(range(100, 0, -1)),
+                   stores([path], "%04x" % (0x4010 + i)))
+
+        # without the lock, cores a cycle apart lose each other's increments
+        files = run(trace, tmp, "race", "-deterministic", "-quantum", "1")
+        expect("racing counter", 100, max(stores(files, "4000")))
+
+        # deterministic runs interleave the cores the same way every time
+        first = run(trace, tmp, "first", "-deterministic", "-quantum", "7", "-lock", "x4001")
+        second = run(trace, tmp, "second", "-deterministic", "-quantum", "7", "-lock", "x4001")
+        for i in range(CORES):
+            if not filecmp.cmp(first[i], second[i], shallow=False):
+                raise AssertionError("core %d traces of deterministic runs differ" % i)
+        expect("deterministic counter", 400, max(stores(first, "4000")))
+    print("system_test: ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
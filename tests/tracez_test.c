@@ -0,0 +1,131 @@
+/*
+ * tracez_test.c: checks the block codec of compressed traces
+ *
+ * Every input must come back unchanged from CompressBlock and DecompressBlock, and fit the
+ * space TRACEZ_PACKED_BOUND promises. Random garbage, damaged and truncated blocks must be
+ * rejected or decode to something that fits, never read or write out of bounds. Buffers are
+ * allocated at their exact size so that a sanitizer or a guard page catches any overrun.
+ */
+
+#include "../tracez.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Random garbage blocks tried
+#define GARBAGE_ROUNDS 20000
+
+// Damaged copies tried for each round trip input
+#define DAMAGE_ROUNDS 200
+
+unsigned long long rng = 0x9E3779B97F4A7C15ull;
+int failures = 0;
+
+unsigned int Random()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (unsigned int) (rng >> 32);
+}
+
+//fills data with lines like the ones trace writes
+void TraceText(unsigned char* data, int size)
+{
+    char line[64];
+    int offset = 0;
+    unsigned int pc = 0x8200;
+    while (offset < size) {
+        int length = sprintf(line, "%04X 0001001001000000 1 %d %04X 1 %d 0 0000 0000\n",
+                             pc, Random() % 8, Random() & 0xFF, 1 << (Random() % 3));
+        pc = (Random() % 4 == 0) ? (Random() & 0x7FFF) : pc + 1;
+        memcpy(data + offset, line, (size - offset < length) ? size - offset : length);
+        offset += length;
+    }
+}
+
+//compresses and decompresses size bytes of src, then feeds damaged copies of the block back in
+void RoundTrip(const char* name, const unsigned char* src, int size)
+{
+    unsigned char* packed = malloc(TRACEZ_PACKED_BOUND(size));
+    unsigned char* raw = malloc(size + 1);
+    int packedSize = CompressBlock(src, size, packed);
+    if (packedSize < 0 || packedSize > TRACEZ_PACKED_BOUND(size)) {
+        printf("error: %s: %d bytes packed into %d\n", name, size, packedSize);
+        failures++;
+    }
+    else if (DecompressBlock(packed, packedSize, raw, size) != size || memcmp(raw, src, size) != 0) {
+        printf("error: %s: %d bytes do not come back unchanged\n", name, size);
+        failures++;
+    }
+    //one byte short of the space it needs must fail rather than overflow
+    else if (size > 0 && DecompressBlock(packed, packedSize, raw, size - 1) != -1) {
+        printf("error: %s: decompressed into %d bytes, one short of its size\n", name, size - 1);
+        failures++;
+    }
+    for (int round = 0; round < DAMAGE_ROUNDS && packedSize > 0; round++) {
+        int length = (round % 2 == 0) ? packedSize : 1 + Random() % packedSize;
+        unsigned char* damaged = malloc(length);
+        memcpy(damaged, packed, length);
+        for (int flips = 1 + Random() % 4; flips > 0; flips--) {
+            damaged[Random() % length] ^= 1u << (Random() % 8);
+        }
+        int result = DecompressBlock(damaged, length, raw, size);
+        if (result < -1 || result > size) {
+            printf("error: %s: a damaged block decoded to %d bytes\n", name, result);
+            failures++;
+        }
+        free(damaged);
+    }
+    free(packed);
+    free(raw);
+}
+
+void Garbage()
+{
+    for (int round = 0; round < GARBAGE_ROUNDS; round++) {
+        int size = Random() % 512;
+        int capacity = Random() % 4096;
+        unsigned char* src = malloc(size + 1);
+        unsigned char* dst = malloc(capacity + 1);
+        for (int i = 0; i < size; i++) {
+            //long runs of 255 exercise the length continuation bytes
+            src[i] = (Random() % 8 == 0) ? 255 : Random();
+        }
+        int result = DecompressBlock(src, size, dst, capacity);
+        if (result < -1 || result > capacity) {
+            printf("error: garbage decoded to %d bytes into %d\n", result, capacity);
+            failures++;
+        }
+        free(src);
+        free(dst);
+    }
+}
+
+int main()
+{
+    static unsigned char data[TRACEZ_BLOCK_SIZE];
+    int sizes[] = {0, 1, 3, 4, 5, 15, 16, 19, 255, 270, 4096, 65535, 65536, 65537, TRACEZ_BLOCK_SIZE};
+    int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+    for (int i = 0; i < numSizes; i++) {
+        TraceText(data, sizes[i]);
+        RoundTrip("trace text", data, sizes[i]);
+        memset(data, 'x', sizes[i]);
+        RoundTrip("one byte repeated", data, sizes[i]);
+        for (int j = 0; j < sizes[i]; j++) {
+            data[j] = Random();
+        }
+        RoundTrip("random bytes", data, sizes[i]);
+        //matches further back than the largest offset, and overlapping ones
+        for (int j = 0; j < sizes[i]; j++) {
+            data[j] = (j % 70000 < 300) ? "abc"[j % 3] : Random() % 4;
+        }
+        RoundTrip("short alphabet", data, sizes[i]);
+    }
+    Garbage();
+    if (failures > 0) {
+        printf("tracez_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("tracez_test: ok\n");
+    return 0;
+}
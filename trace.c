@@ -3,10 +3,297 @@
  */
 
 #include "loader.h"
+#include "events.h"
+#include "gdbstub.h"
+#include "tracez.h"
+#include "system.h"
+#include <unistd.h>
 
 // Global variable defining the current state of the machine
 MachineState* CPU;
 
+// Memory of the machine, shared by all cores in system mode
+unsigned short int memory[65536];
+
+// Cores run with -cores, 0 runs the single core machine
+int num_cores = 0;
+SystemState lc4_system;
+
+// Stop conditions armed from the command line
+EventState events;
+
+// Which instructions get a trace line
+TraceFilter filter;
+
+// Worker threads compressing the trace, 0 writes plain text
+int compress_threads = 0;
+
+// Directory caching parsed object files, NULL if none
+char* cache_dir = NULL;
+
+// Socket to serve gdb on instead of running straight through, NULL if none
+char* gdb_address = NULL;
+
+/*
+ * Parses a hex address such as 80FF, x80FF or 0x80FF. Returns -1 if it is not valid.
+ */
+int ParseAddress(char* text, unsigned short int* address)
+{
+    char* end;
+    if (text[0] == 'x' || text[0] == 'X') {
+        text++;
+    }
+    unsigned long value = strtoul(text, &end, 16);
+    if (*text == '\0' || *end != '\0' || value > 0xFFFF) {
+        return -1;
+    }
+    *address = (unsigned short int) value;
+    return 0;
+}
+
+/*
+ * Parses a register condition such as R3=x1234, PC=x0200 or PSR=x8001. Returns -1 if it is not valid.
+ */
+int ParseCondition(char* text, EventState* events)
+{
+    int reg;
+    unsigned short int value;
+    char* equals = strchr(text, '=');
+    if (equals == NULL) {
+        return -1;
+    }
+    *equals = '\0';
+    if (strcmp(text, "PC") == 0) {
+        reg = REG_PC;
+    }
+    else if (strcmp(text, "PSR") == 0) {
+        reg = REG_PSR;
+    }
+    else if (text[0] == 'R' && text[1] >= '0' && text[1] <= '7' && text[2] == '\0') {
+        reg = text[1] - '0';
+    }
+    else {
+        return -1;
+    }
+    if (ParseAddress(equals + 1, &value) != 0) {
+        return -1;
+    }
+    return AddRegisterCondition(events, reg, value);
+}
+
+/*
+ * Parses the options in front of the output file. Returns the index of the first
+ * remaining argument, or -1 if an option is not valid.
+ */
+int ParseOptions(int argc, char** argv, EventState* events)
+{
+    unsigned short int address;
+    int i = 1;
+    while (i < argc && argv[i][0] == '-') {
+        //user and OS space are split at x8000, as in CheckPermissions
+        if (strcmp(argv[i], "-user") == 0 || strcmp(argv[i], "-os") == 0) {
+            filter.low = (argv[i][1] == 'u') ? 0x0000 : 0x8000;
+            filter.high = (argv[i][1] == 'u') ? 0x7FFF : 0xFFFF;
+            events->filter = &filter;
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "-deterministic") == 0) {
+            lc4_system.deterministic = 1;
+            i++;
+            continue;
+        }
+        if (i + 1 == argc) {
+            printf("error: option %s needs a value\n", argv[i]);
+            return -1;
+        }
+        if (strcmp(argv[i], "-cycles") == 0) {
+            unsigned long long cycles;
+            if (ParseCycles(argv[i + 1], &cycles) != 0) {
+                printf("error: invalid cycle count %s\n", argv[i + 1]);
+                return -1;
+            }
+            SetCycleLimit(events, cycles);
+        }
+        else if (strcmp(argv[i], "-reg") == 0) {
+            if (ParseCondition(argv[i + 1], events) != 0) {
+                printf("error: invalid register condition %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-cache") == 0) {
+            cache_dir = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-gdb") == 0) {
+            gdb_address = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-compress") == 0) {
+            compress_threads = atoi(argv[i + 1]);
+            if (compress_threads < 1) {
+                printf("error: invalid number of compression threads %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-cores") == 0) {
+            num_cores = atoi(argv[i + 1]);
+            if (num_cores < 1 || num_cores > MAX_CORES) {
+                printf("error: invalid number of cores %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-quantum") == 0) {
+            char* end;
+            lc4_system.quantum = strtoull(argv[i + 1], &end, 10);
+            if (*end != '\0' || lc4_system.quantum == 0) {
+                printf("error: invalid quantum %s\n", argv[i + 1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-only") == 0) {
+            if (SetOpcodeClasses(&filter, argv[i + 1]) != 0) {
+                printf("error: invalid opcode classes %s\n", argv[i + 1]);
+                return -1;
+            }
+            events->filter = &filter;
+        }
+        else if (strcmp(argv[i], "-every") == 0 || strcmp(argv[i], "-sample") == 0) {
+            unsigned long long period;
+            if (ParseCycles(argv[i + 1], &period) != 0 || period == 0) {
+                printf("error: invalid sampling period %s\n", argv[i + 1]);
+                return -1;
+            }
+            SetSampling(&filter, period, strcmp(argv[i], "-sample") == 0);
+            events->filter = &filter;
+        }
+        else if (strcmp(argv[i], "-pcrange") == 0) {
+            char* dash = strchr(argv[i + 1], '-');
+            if (dash == NULL) {
+                printf("error: invalid PC range %s\n", argv[i + 1]);
+                return -1;
+            }
+            *dash = '\0';
+            if (ParseAddress(argv[i + 1], &filter.low) != 0 || ParseAddress(dash + 1, &filter.high) != 0 ||
+                filter.low > filter.high) {
+                printf("error: invalid PC range %s-%s\n", argv[i + 1], dash + 1);
+                return -1;
+            }
+            events->filter = &filter;
+        }
+        else if (ParseAddress(argv[i + 1], &address) != 0) {
+            printf("error: invalid address %s\n", argv[i + 1]);
+            return -1;
+        }
+        else if (strcmp(argv[i], "-halt") == 0) {
+            AddHaltPC(events, address);
+        }
+        else if (strcmp(argv[i], "-break") == 0) {
+            AddBreakpoint(events, address);
+        }
+        else if (strcmp(argv[i], "-rwatch") == 0) {
+            AddWatchpoint(events, address, WATCH_READ);
+        }
+        else if (strcmp(argv[i], "-wwatch") == 0) {
+            AddWatchpoint(events, address, WATCH_WRITE);
+        }
+        else if (strcmp(argv[i], "-watch") == 0) {
+            AddWatchpoint(events, address, WATCH_READ | WATCH_WRITE);
+        }
+        else if (strcmp(argv[i], "-lock") == 0) {
+            AddAtomicWord(&lc4_system, address, ATOMIC_LOCK);
+        }
+        else if (strcmp(argv[i], "-mailbox") == 0) {
+            AddAtomicWord(&lc4_system, address, ATOMIC_MAILBOX);
+        }
+        else {
+            printf("error: unknown option %s\n", argv[i]);
+            return -1;
+        }
+        i += 2;
+    }
+    return i;
+}
+
+/*
+ * Opens a trace file for writing, compressed if -compress was given.
+ */
+FILE* OpenTrace(char* name)
+{
+    if (compress_threads > 0) {
+        return OpenCompressedTrace(name, compress_threads);
+    }
+    return fopen(name, "w");
+}
+
+/*
+ * Closes a trace, a compressed one is only complete once its index has been written.
+ */
+int CloseTrace(FILE* fp, char* name)
+{
+    if (fclose(fp) != 0) {
+        printf("error: could not finish writing %s\n", (name != NULL) ? name : "the trace");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs the loaded program on num_cores cores, core n writing to output with .coreN put in front of
+ * its .txt, so out.txt becomes out.core0.txt and a compressed out.z becomes out.core0.z.
+ */
+int RunCores(char* output)
+{
+    FILE* outputs[MAX_CORES];
+    char name[4096];
+    char* suffix = strstr(output, ".txt");
+    //a compressed trace need not end in .txt, the core number goes in front of its extension if any
+    if (suffix == NULL) {
+        suffix = strrchr(output, '.');
+        if (suffix == NULL || strchr(suffix, '/') != NULL) {
+            suffix = output + strlen(output);
+        }
+    }
+    if (gdb_address != NULL) {
+        printf("error: -gdb debugs a single core\n");
+        return -1;
+    }
+    if (strlen(output) + 16 > sizeof(name)) {
+        printf("error: the name %s is too long\n", output);
+        return -1;
+    }
+    int opened = 0;
+    for (; opened < num_cores; opened++) {
+        sprintf(name, "%.*s.core%d%s", (int) (suffix - output), output, opened, suffix);
+        outputs[opened] = OpenTrace(name);
+        if (outputs[opened] == NULL) {
+            printf("error: could not create file %s\n", name);
+            break;
+        }
+    }
+    if (opened < num_cores || CreateCores(&lc4_system, num_cores, memory, &events) != 0) {
+        //nothing has run, so the traces already opened are closed and removed rather than left empty
+        for (int i = 0; i < opened; i++) {
+            CloseTrace(outputs[i], NULL);
+            sprintf(name, "%.*s.core%d%s", (int) (suffix - output), output, i, suffix);
+            remove(name);
+        }
+        FreeSystem(&lc4_system);
+        return -1;
+    }
+    int result = RunSystem(&lc4_system, outputs);
+    for (int i = 0; i < num_cores; i++) {
+        CoreState* core = &lc4_system.cores[i];
+        if (core->reason != STOP_HALT && core->reason != STOP_ERROR) {
+            printf("core %d stopped: %s at x%04X after %llu cycles\n", i, StopReasonName(core->reason),
+                   core->events.stopAddr, core->events.cycles);
+        }
+        if (CloseTrace(outputs[i], NULL) != 0) {
+            result = -1;
+        }
+    }
+    FreeSystem(&lc4_system);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     //instantiates the machine
@@ -24,49 +311,83 @@ int main(int argc, char** argv)
     .NZPVal = 0,
     .dmemAddr = 0,
     .dmemValue = 0,
-    .memory = {0}
+    .events = NULL,
+    .system = NULL,
+    .memory = memory
     };
     CPU = &machineState;
     char* output_file = NULL;       //name of the output file
     FILE *fp;                       //file datatype of the current file
-    int filename_len;               //length of filename
+    //the machine always stops at x80FF, the options can add more stop conditions
+    InitEvents(&events);
+    AddHaltPC(&events, 0x80FF);
+    InitFilter(&filter);
+    InitSystem(&lc4_system);
+    int first = ParseOptions(argc, argv, &events);
+    if (first < 0) {
+        return -1;
+    }
+    //compressed traces are indexed by cycle, which needs a line for every cycle
+    if (compress_threads > 0 && events.filter != NULL) {
+        printf("error: -compress can not be combined with -user, -os, -only, -pcrange, -every or -sample\n");
+        return -1;
+    }
     //checks proper number of args
-    if (argc < 3) {
+    if (argc - first < 2) {
         printf("error: you must specify the name of your output file and at least one object file\n");
         return -1;
     }
-    //checks that destination file is a text file
-    if (strstr(argv[1],".txt") == NULL) {
+    //checks that destination file is a text file, a compressed trace is binary and may be named anything
+    if (compress_threads == 0 && strstr(argv[first],".txt") == NULL) {
         printf("error: the destination file is not a text file\n");
         return -1;
     }
-    //checks that all obj files exist
-    for (int i = 2; i < argc; i++) {
-        filename_len = strlen(argv[i]);
-        fp = fopen(argv[i],"rb");
-        if (fp == NULL || strstr(argv[i],".obj") == NULL) {
-            printf("error: one or more specified object files do not exist\n");
+    //checks that all obj files are object files, the loader reports the ones it can not open
+    for (int i = first + 1; i < argc; i++) {
+        if (strstr(argv[i],".obj") == NULL) {
+            printf("error: %s is not an object file\n", argv[i]);
             return -1;
         }
-        fclose(fp);
     }
     //loads the programs into memory
-    for (int i = 2; i < argc; i++) {
-        ReadObjectFile(argv[i], CPU);
+    if (LoadObjectFiles(&argv[first + 1], argc - first - 1, CPU, cache_dir) != 0) {
+        return -1;
+    }
+    if (num_cores > 0) {
+        return RunCores(argv[first]);
+    }
+    if (lc4_system.numAtomic > 0 || lc4_system.deterministic) {
+        printf("error: -lock, -mailbox and -deterministic need -cores\n");
+        return -1;
+    }
+    //the debugger connects before the trace is created, so a bad socket leaves no file behind
+    int gdb_fd = -1;
+    if (gdb_address != NULL) {
+        gdb_fd = ListenGDB(gdb_address);
+        if (gdb_fd < 0) {
+            printf("error: could not open gdb socket %s\n", gdb_address);
+            return -1;
+        }
     }
     //executes the machine
-    fp = fopen(argv[1], "w");
+    fp = OpenTrace(argv[first]);
     if (fp == NULL) {
         printf("error: could not create file\n");
+        if (gdb_fd >= 0) {
+            close(gdb_fd);
+        }
         return -1;
     }
-    int success;
-    while (CPU->PC != 0x80FF) {
-        success = UpdateMachineState(CPU, fp);
-        if (success != 0) {
-            break;
+    if (gdb_address != NULL) {
+        int result = ServeGDB(CPU, fp, &events, gdb_fd);
+        if (CloseTrace(fp, argv[first]) != 0) {
+            return -1;
         }
+        return result;
     }
-    fclose(fp);
-    return 0;
-}
\ No newline at end of file
+    int reason = RunMachine(CPU, fp, &events);
+    if (reason != STOP_HALT && reason != STOP_ERROR) {
+        printf("stopped: %s at x%04X after %llu cycles\n", StopReasonName(reason), events.stopAddr, events.cycles);
+    }
+    return CloseTrace(fp, argv[first]);
+}
@@ -0,0 +1,71 @@
+/*
+ * tracecat.c: location of main() for printing compressed traces
+ *
+ * tracecat [-from N] [-count M] trace.z prints the lines for cycles N to N+M-1 of a trace
+ * written by trace -compress, only decompressing the blocks that hold them.
+ */
+
+#include "tracez.h"
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv)
+{
+    TraceReader reader;
+    unsigned long long from = 0;
+    unsigned long long count = 0xFFFFFFFFFFFFFFFFull;
+    int i = 1;
+    //parses the options in front of the trace file
+    while (i + 1 < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-from") == 0) {
+            from = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-count") == 0) {
+            count = strtoull(argv[i + 1], NULL, 10);
+        }
+        else {
+            printf("error: unknown option %s\n", argv[i]);
+            return -1;
+        }
+        i += 2;
+    }
+    if (i + 1 != argc) {
+        printf("error: usage: tracecat [-from N] [-count M] trace\n");
+        return -1;
+    }
+    if (OpenTraceReader(&reader, argv[i]) != 0) {
+        printf("error: %s is not a compressed trace\n", argv[i]);
+        return -1;
+    }
+    char* raw = malloc(TRACEZ_BLOCK_SIZE);
+    int block = FindTraceBlock(&reader, from);
+    if (raw == NULL) {
+        printf("error: out of memory\n");
+        return -1;
+    }
+    while (block >= 0 && block < (int) reader.numBlocks && count > 0) {
+        int size = ReadTraceBlock(&reader, block, raw);
+        if (size < 0) {
+            printf("error: block %d is corrupt\n", block);
+            return -1;
+        }
+        //skips the lines in front of from, then prints up to count of the rest
+        unsigned long long line = reader.index[block].firstLine;
+        char* start = raw;
+        char* end = raw + size;
+        while (start < end && count > 0) {
+            char* newline = memchr(start, '\n', end - start);
+            char* next = (newline == NULL) ? end : newline + 1;
+            if (line >= from) {
+                fwrite(start, 1, next - start, stdout);
+                count--;
+            }
+            line++;
+            start = next;
+        }
+        block++;
+    }
+    free(raw);
+    CloseTraceReader(&reader);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * tracecmp.c: location of main() for the trace comparison tool
+ *
+ * Compares two text traces as written by trace (or PennSim) without reading them line by
+ * line: both files are mapped and compared in large memcmp blocks, and lines are only
+ * looked at where the blocks differ. Stops at the first mismatching line, or with -all
+ * keeps going and counts mismatches per field.
+ */
+
+#include "LC4.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes compared per memcmp while looking for the next difference
+#define BLOCK_SIZE (1 << 20)
+
+// Fields of a trace line
+#define NUM_FIELDS 10
+const char* field_names[NUM_FIELDS] = {
+    "PC", "instruction", "regfile WE", "register", "regfile value",
+    "NZP WE", "NZP value", "dmem WE", "dmem address", "dmem value"
+};
+
+typedef struct {
+    char* name;
+    const char* data;
+    size_t size;
+} TraceFile;
+
+int OpenTrace(TraceFile* trace, char* name)
+{
+    struct stat info;
+    int fd = open(name, O_RDONLY);
+    trace->name = name;
+    trace->data = NULL;
+    trace->size = 0;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        printf("error: could not open %s\n", name);
+        return -1;
+    }
+    trace->size = info.st_size;
+    if (trace->size > 0) {
+        trace->data = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (trace->data == MAP_FAILED) {
+            printf("error: could not map %s\n", name);
+            close(fd);
+            return -1;
+        }
+        madvise((void*) trace->data, trace->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return 0;
+}
+
+//returns how many leading bytes of a and b are equal, looking at no more than length
+size_t CommonPrefix(const char* a, const char* b, size_t length)
+{
+    size_t offset = 0;
+    while (offset < length) {
+        size_t block = (length - offset < BLOCK_SIZE) ? length - offset : BLOCK_SIZE;
+        if (memcmp(a + offset, b + offset, block) == 0) {
+            offset += block;
+            continue;
+        }
+        //narrows the block down before going byte by byte
+        while (block > 64) {
+            size_t half = block / 2;
+            if (memcmp(a + offset, b + offset, half) == 0) {
+                offset += half;
+                block -= half;
+            }
+            else {
+                block = half;
+            }
+        }
+        while (a[offset] == b[offset]) {
+            offset++;
+        }
+        return offset;
+    }
+    return length;
+}
+
+size_t CountLines(const char* data, size_t length)
+{
+    size_t lines = 0;
+    for (size_t i = 0; i < length; i++) {
+        lines += (data[i] == '\n');
+    }
+    return lines;
+}
+
+//returns the offset of the start of the line holding offset
+size_t LineStart(TraceFile* trace, size_t offset)
+{
+    while (offset > 0 && trace->data[offset - 1] != '\n') {
+        offset--;
+    }
+    return offset;
+}
+
+//returns the length of the line at offset, without its newline
+size_t LineLength(TraceFile* trace, size_t offset)
+{
+    const char* end = memchr(trace->data + offset, '\n', trace->size - offset);
+    return (end == NULL) ? trace->size - offset : end - (trace->data + offset);
+}
+
+//splits a line into its space separated fields, returns how many there are
+int SplitFields(const char* line, size_t length, const char** fields, size_t* lengths)
+{
+    int count = 0;
+    size_t i = 0;
+    while (i < length && count < NUM_FIELDS) {
+        while (i < length && (line[i] == ' ' || line[i] == '\r')) {
+            i++;
+        }
+        if (i == length) {
+            break;
+        }
+        fields[count] = line + i;
+        while (i < length && line[i] != ' ' && line[i] != '\r') {
+            i++;
+        }
+        lengths[count] = line + i - fields[count];
+        count++;
+    }
+    return count;
+}
+
+//returns a bit per field that differs between the two lines
+int CompareFields(const char* a, size_t lengthA, const char* b, size_t lengthB)
+{
+    const char* fieldsA[NUM_FIELDS];
+    const char* fieldsB[NUM_FIELDS];
+    size_t lengthsA[NUM_FIELDS], lengthsB[NUM_FIELDS];
+    int countA = SplitFields(a, lengthA, fieldsA, lengthsA);
+    int countB = SplitFields(b, lengthB, fieldsB, lengthsB);
+    int mask = 0;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (i >= countA || i >= countB) {
+            if (i < countA || i < countB) {
+                mask |= 1 << i;
+            }
+        }
+        else if (lengthsA[i] != lengthsB[i] || memcmp(fieldsA[i], fieldsB[i], lengthsA[i]) != 0) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+//decodes the instruction field of a trace line
+void DecodeLine(const char* line, size_t length, char* text)
+{
+    const char* fields[NUM_FIELDS];
+    size_t lengths[NUM_FIELDS];
+    unsigned short int instruction = 0;
+    if (SplitFields(line, length, fields, lengths) < 2 || lengths[1] != 16) {
+        strcpy(text, "?");
+        return;
+    }
+    for (int i = 0; i < 16; i++) {
+        instruction = (instruction << 1u) | (fields[1][i] == '1');
+    }
+    Disassemble(instruction, text);
+}
+
+void ReportMismatch(TraceFile* a, size_t offsetA, TraceFile* b, size_t offsetB, size_t line, int mask)
+{
+    char text[32];
+    size_t lengthA = (offsetA < a->size) ? LineLength(a, offsetA) : 0;
+    size_t lengthB = (offsetB < b->size) ? LineLength(b, offsetB) : 0;
+    //PennSim writes CRLF line endings
+    while (lengthA > 0 && a->data[offsetA + lengthA - 1] == '\r') {
+        lengthA--;
+    }
+    while (lengthB > 0 && b->data[offsetB + lengthB - 1] == '\r') {
+        lengthB--;
+    }
+    printf("mismatch at line %zu:", line);
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (mask & (1 << i)) {
+            printf(" %s", field_names[i]);
+        }
+    }
+    printf("\n");
+    if (offsetA < a->size) {
+        DecodeLine(a->data + offsetA, lengthA, text);
+        printf("  %s: %.*s   %s\n", a->name, (int) lengthA, a->data + offsetA, text);
+    }
+    else {
+        printf("  %s: end of file\n", a->name);
+    }
+    if (offsetB < b->size) {
+        DecodeLine(b->data + offsetB, lengthB, text);
+        printf("  %s: %.*s   %s\n", b->name, (int) lengthB, b->data + offsetB, text);
+    }
+    else {
+        printf("  %s: end of file\n", b->name);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    TraceFile a, b;
+    int all = 0;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "-all") == 0) {
+        all = 1;
+        first = 2;
+    }
+    if (argc - first != 2) {
+        printf("error: usage: tracecmp [-all] trace1.txt trace2.txt\n");
+        return -1;
+    }
+    if (OpenTrace(&a, argv[first]) != 0 || OpenTrace(&b, argv[first + 1]) != 0) {
+        return -1;
+    }
+
+    size_t offsetA = 0, offsetB = 0, line = 1, mismatches = 0;
+    size_t counts[NUM_FIELDS] = {0};
+    int longer = 0;
+    //set once the files turn out to end their lines differently, after which the block compare
+    //would stop on every line
+    int endings = 0;
+    while (1) {
+        size_t lengthA, lengthB;
+        if (endings) {
+            if (offsetA >= a.size && offsetB >= b.size) {
+                break;
+            }
+            lengthA = (offsetA < a.size) ? LineLength(&a, offsetA) : 0;
+            lengthB = (offsetB < b.size) ? LineLength(&b, offsetB) : 0;
+            //compares the lines without their \r, only going field by field when that fails
+            size_t bodyA = lengthA, bodyB = lengthB;
+            while (bodyA > 0 && a.data[offsetA + bodyA - 1] == '\r') {
+                bodyA--;
+            }
+            while (bodyB > 0 && b.data[offsetB + bodyB - 1] == '\r') {
+                bodyB--;
+            }
+            if (offsetA < a.size && offsetB < b.size && bodyA == bodyB &&
+                memcmp(a.data + offsetA, b.data + offsetB, bodyA) == 0) {
+                offsetA += lengthA + (offsetA + lengthA < a.size);
+                offsetB += lengthB + (offsetB + lengthB < b.size);
+                line++;
+                continue;
+            }
+        }
+        else {
+            //skips over the identical stretch, counting the lines in it
+            size_t length = (a.size - offsetA < b.size - offsetB) ? a.size - offsetA : b.size - offsetB;
+            size_t same = CommonPrefix(a.data + offsetA, b.data + offsetB, length);
+            if (same == length && a.size - offsetA == b.size - offsetB) {
+                line += CountLines(a.data + offsetA, same);
+                break;
+            }
+            size_t start = LineStart(&a, offsetA + same);
+            if (start < offsetA) {
+                start = offsetA;
+            }
+            line += CountLines(a.data + offsetA, start - offsetA);
+            offsetB += start - offsetA;
+            offsetA = start;
+
+            //both lines start at offsetA and offsetB and differ somewhere
+            lengthA = (offsetA < a.size) ? LineLength(&a, offsetA) : 0;
+            lengthB = (offsetB < b.size) ? LineLength(&b, offsetB) : 0;
+        }
+        int mask = CompareFields(a.data + offsetA, lengthA, b.data + offsetB, lengthB);
+        longer = (offsetA >= a.size || offsetB >= b.size);
+        if (longer) {
+            mask = (1 << NUM_FIELDS) - 1;
+        }
+        //lines that only differ in their line endings or a missing final newline are equal
+        if (mask == 0) {
+            endings = 1;
+        }
+        else {
+            if (mismatches == 0 || !all) {
+                ReportMismatch(&a, offsetA, &b, offsetB, line, mask);
+            }
+            mismatches++;
+            if (!all || longer) {
+                break;
+            }
+            for (int i = 0; i < NUM_FIELDS; i++) {
+                if (mask & (1 << i)) {
+                    counts[i]++;
+                }
+            }
+        }
+        offsetA += lengthA + (offsetA + lengthA < a.size);
+        offsetB += lengthB + (offsetB + lengthB < b.size);
+        line++;
+    }
+
+    if (mismatches == 0) {
+        printf("traces match: %zu lines\n", line - 1);
+        return 0;
+    }
+    if (all) {
+        printf("%zu mismatched lines\n", mismatches);
+        for (int i = 0; i < NUM_FIELDS; i++) {
+            if (counts[i] > 0) {
+                printf("  %-14s %zu\n", field_names[i], counts[i]);
+            }
+        }
+        if (longer) {
+            printf("  %s is longer\n", offsetA >= a.size ? b.name : a.name);
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,633 @@
+/*
+ * tracez.c: Defines compressed trace files
+ *
+ * The simulator writes trace lines into a stdio stream (fopencookie) that fills one block at
+ * a time. Full blocks are handed to a pool of worker threads for compression and written out
+ * in order by the simulator's thread, so the only work left on it is a memcpy per line.
+ */
+
+#define _GNU_SOURCE
+#include "tracez.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Codec parameters
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+
+// Sizes of the header, an index entry and the footer in the file
+#define HEADER_SIZE 12
+#define INDEX_ENTRY_SIZE 32
+#define FOOTER_SIZE 16
+
+// States of a block in the writer's ring
+#define BLOCK_FREE 0
+#define BLOCK_QUEUED 1
+#define BLOCK_DONE 2
+
+typedef struct {
+    unsigned char* raw;
+    int rawSize;
+    unsigned char* packed;
+    int packedSize;
+    unsigned int lines;
+    int state;
+} WriteBlock;
+
+typedef struct {
+    FILE* fp;
+
+    // ring of blocks, block number n uses slots[n % numSlots]
+    WriteBlock* slots;
+    int numSlots;
+    unsigned long long submitted;
+    unsigned long long taken;
+    unsigned long long written;
+
+    // the block the simulator is filling
+    unsigned char* current;
+    int currentSize;
+
+    // where the next block goes, and the index so far
+    unsigned long long offset;
+    unsigned long long lines;
+    TraceBlockIndex* index;
+    unsigned int indexCapacity;
+
+    pthread_t* threads;
+    int numThreads;
+    int closing;
+
+    // set when the index could not grow, the trace is then closed without one and fails
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t blockDone;
+} TraceWriter;
+
+
+static void PutLE32(unsigned char* out, unsigned int value)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static void PutLE64(unsigned char* out, unsigned long long value)
+{
+    for (int i = 0; i < 8; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static unsigned int GetLE32(const unsigned char* in)
+{
+    return in[0] | (in[1] << 8u) | (in[2] << 16u) | ((unsigned int) in[3] << 24u);
+}
+
+static unsigned long long GetLE64(const unsigned char* in)
+{
+    return GetLE32(in) | ((unsigned long long) GetLE32(in + 4) << 32u);
+}
+
+
+//////////////// BLOCK CODEC ///////////////////////////
+
+
+static unsigned int Hash4(const unsigned char* p)
+{
+    unsigned int value;
+    memcpy(&value, p, 4);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//writes the bytes that follow a length nibble of 15
+static unsigned char* PutLength(unsigned char* out, int length)
+{
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+//writes a sequence: a token, the literals and, unless it is the last one, a match
+static unsigned char* PutSequence(unsigned char* out, const unsigned char* literals, int numLiterals, int offset, int matchLength)
+{
+    unsigned char* token = out++;
+    *token = (numLiterals < 15 ? numLiterals : 15) << 4u;
+    if (numLiterals >= 15) {
+        out = PutLength(out, numLiterals - 15);
+    }
+    memcpy(out, literals, numLiterals);
+    out += numLiterals;
+    if (offset == 0) {
+        return out;
+    }
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8u;
+    matchLength -= MIN_MATCH;
+    *token |= matchLength < 15 ? matchLength : 15;
+    if (matchLength >= 15) {
+        out = PutLength(out, matchLength - 15);
+    }
+    return out;
+}
+
+/*
+ * Compress size bytes of src into dst, returns the packed size.
+ */
+int CompressBlock(const unsigned char* src, int size, unsigned char* dst)
+{
+    int table[1 << HASH_BITS];
+    const unsigned char* anchor = src;
+    const unsigned char* ip = src;
+    const unsigned char* end = src + size;
+    unsigned char* op = dst;
+    memset(table, 0xFF, sizeof(table));
+    while (ip + MIN_MATCH <= end) {
+        unsigned int h = Hash4(ip);
+        int candidate = table[h];
+        table[h] = ip - src;
+        if (candidate < 0 || (ip - src) - candidate > MAX_OFFSET || memcmp(src + candidate, ip, MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        //extends the match as far as it goes, it may overlap ip
+        const unsigned char* match = src + candidate;
+        int length = MIN_MATCH;
+        while (ip + length < end && match[length] == ip[length]) {
+            length++;
+        }
+        op = PutSequence(op, anchor, ip - anchor, ip - match, length);
+        ip += length;
+        anchor = ip;
+        //keeps the table fresh at the end of the match
+        if (ip + MIN_MATCH <= end) {
+            table[Hash4(ip - 2)] = ip - 2 - src;
+        }
+    }
+    op = PutSequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+//reads the bytes that follow a length nibble of 15, returns -1 past the end of the input
+static int GetLength(const unsigned char** in, const unsigned char* end)
+{
+    int length = 0;
+    unsigned char byte;
+    do {
+        if (*in >= end) {
+            return -1;
+        }
+        byte = *(*in)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+/*
+ * Decompress size bytes of src into dst, returns the unpacked size or -1 if src is corrupt.
+ */
+int DecompressBlock(const unsigned char* src, int size, unsigned char* dst, int capacity)
+{
+    const unsigned char* ip = src;
+    const unsigned char* end = src + size;
+    unsigned char* op = dst;
+    unsigned char* limit = dst + capacity;
+    int numLiterals, length, offset, extra;
+    while (ip < end) {
+        unsigned char token = *ip++;
+        numLiterals = token >> 4u;
+        if (numLiterals == 15) {
+            extra = GetLength(&ip, end);
+            if (extra < 0) {
+                return -1;
+            }
+            numLiterals += extra;
+        }
+        if (numLiterals > end - ip || numLiterals > limit - op) {
+            return -1;
+        }
+        memcpy(op, ip, numLiterals);
+        op += numLiterals;
+        ip += numLiterals;
+        //the last sequence has no match
+        if (ip == end) {
+            break;
+        }
+        if (end - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8u);
+        ip += 2;
+        length = token & 0x0F;
+        if (length == 15) {
+            extra = GetLength(&ip, end);
+            if (extra < 0) {
+                return -1;
+            }
+            length += extra;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > op - dst || length > limit - op) {
+            return -1;
+        }
+        //matches may overlap the bytes they produce, so copy forwards one at a time
+        const unsigned char* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else {
+            for (int i = 0; i < length; i++) {
+                *op++ = match[i];
+            }
+        }
+    }
+    return op - dst;
+}
+
+
+//////////////// WRITER ///////////////////////////
+
+
+//compresses queued blocks until the writer closes
+static void* CompressWorker(void* arg)
+{
+    TraceWriter* writer = (TraceWriter*) arg;
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (writer->taken == writer->submitted && !writer->closing) {
+            pthread_cond_wait(&writer->workReady, &writer->lock);
+        }
+        if (writer->taken == writer->submitted) {
+            break;
+        }
+        WriteBlock* block = &writer->slots[writer->taken % writer->numSlots];
+        writer->taken++;
+        pthread_mutex_unlock(&writer->lock);
+
+        block->lines = 0;
+        for (int i = 0; i < block->rawSize; i++) {
+            block->lines += (block->raw[i] == '\n');
+        }
+        block->packedSize = CompressBlock(block->raw, block->rawSize, block->packed);
+
+        pthread_mutex_lock(&writer->lock);
+        block->state = BLOCK_DONE;
+        pthread_cond_broadcast(&writer->blockDone);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+//writes out compressed blocks in order, waiting for them if wait is set. Called with the lock held
+static void WriteFinished(TraceWriter* writer, int wait)
+{
+    while (writer->written < writer->submitted) {
+        WriteBlock* block = &writer->slots[writer->written % writer->numSlots];
+        if (block->state != BLOCK_DONE) {
+            if (!wait) {
+                return;
+            }
+            pthread_cond_wait(&writer->blockDone, &writer->lock);
+            continue;
+        }
+        if (writer->written == writer->indexCapacity) {
+            unsigned int capacity = writer->indexCapacity ? 2 * writer->indexCapacity : 256;
+            TraceBlockIndex* index = realloc(writer->index, capacity * sizeof(TraceBlockIndex));
+            if (index == NULL) {
+                //drops the block, the trace will fail to close
+                writer->failed = 1;
+                block->state = BLOCK_FREE;
+                writer->written++;
+                continue;
+            }
+            writer->index = index;
+            writer->indexCapacity = capacity;
+        }
+        if (writer->failed) {
+            block->state = BLOCK_FREE;
+            writer->written++;
+            continue;
+        }
+        TraceBlockIndex* entry = &writer->index[writer->written];
+        entry->offset = writer->offset;
+        entry->firstLine = writer->lines;
+        entry->rawSize = block->rawSize;
+        entry->lines = block->lines;
+        //blocks that do not get smaller are stored as they are
+        if (block->packedSize < block->rawSize) {
+            entry->packedSize = block->packedSize;
+            entry->flags = 0;
+            fwrite(block->packed, 1, block->packedSize, writer->fp);
+        }
+        else {
+            entry->packedSize = block->rawSize;
+            entry->flags = TRACEZ_STORED;
+            fwrite(block->raw, 1, block->rawSize, writer->fp);
+        }
+        writer->offset += entry->packedSize;
+        writer->lines += block->lines;
+        block->state = BLOCK_FREE;
+        writer->written++;
+    }
+}
+
+//hands the first size bytes of the current block to the workers, the rest starts the next block
+static void SubmitBlock(TraceWriter* writer, int size)
+{
+    pthread_mutex_lock(&writer->lock);
+    //waits for the slot to come free if the workers are behind
+    while (writer->submitted - writer->written >= writer->numSlots) {
+        WriteFinished(writer, 0);
+        if (writer->submitted - writer->written >= writer->numSlots) {
+            pthread_cond_wait(&writer->blockDone, &writer->lock);
+        }
+    }
+    WriteBlock* block = &writer->slots[writer->submitted % writer->numSlots];
+    unsigned char* next = block->raw;
+    block->raw = writer->current;
+    block->rawSize = size;
+    block->state = BLOCK_QUEUED;
+    writer->submitted++;
+    pthread_cond_signal(&writer->workReady);
+    WriteFinished(writer, 0);
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->currentSize -= size;
+    memcpy(next, block->raw + size, writer->currentSize);
+    writer->current = next;
+}
+
+static ssize_t WriteTrace(void* cookie, const char* data, size_t size)
+{
+    TraceWriter* writer = (TraceWriter*) cookie;
+    size_t done = 0;
+    if (writer->failed) {
+        return -1;
+    }
+    while (done < size) {
+        size_t length = size - done;
+        if (length > TRACEZ_BLOCK_SIZE - writer->currentSize) {
+            length = TRACEZ_BLOCK_SIZE - writer->currentSize;
+        }
+        memcpy(writer->current + writer->currentSize, data + done, length);
+        writer->currentSize += length;
+        done += length;
+        //blocks end on a whole line so that every block starts on a new cycle
+        if (writer->currentSize == TRACEZ_BLOCK_SIZE) {
+            unsigned char* newline = memrchr(writer->current, '\n', writer->currentSize);
+            SubmitBlock(writer, (newline == NULL) ? writer->currentSize : newline + 1 - writer->current);
+        }
+    }
+    return size;
+}
+
+//frees the writer and everything it allocated, any of which may be missing
+static void FreeWriter(TraceWriter* writer)
+{
+    if (writer->slots != NULL) {
+        for (int i = 0; i < writer->numSlots; i++) {
+            free(writer->slots[i].raw);
+            free(writer->slots[i].packed);
+        }
+    }
+    free(writer->slots);
+    free(writer->current);
+    free(writer->index);
+    free(writer->threads);
+    free(writer);
+}
+
+//stops the compression workers, after they have finished all queued blocks
+static void StopWorkers(TraceWriter* writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = 1;
+    pthread_cond_broadcast(&writer->workReady);
+    WriteFinished(writer, 1);
+    pthread_mutex_unlock(&writer->lock);
+    for (int i = 0; i < writer->numThreads; i++) {
+        pthread_join(writer->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->workReady);
+    pthread_cond_destroy(&writer->blockDone);
+}
+
+static int CloseTrace(void* cookie)
+{
+    TraceWriter* writer = (TraceWriter*) cookie;
+    unsigned char bytes[INDEX_ENTRY_SIZE];
+    int result = 0;
+    if (writer->currentSize > 0) {
+        SubmitBlock(writer, writer->currentSize);
+    }
+    StopWorkers(writer);
+
+    //without a complete index the file is left without a footer, so readers reject it
+    for (unsigned long long i = 0; i < writer->written && !writer->failed; i++) {
+        PutLE64(bytes, writer->index[i].offset);
+        PutLE64(bytes + 8, writer->index[i].firstLine);
+        PutLE32(bytes + 16, writer->index[i].packedSize);
+        PutLE32(bytes + 20, writer->index[i].rawSize);
+        PutLE32(bytes + 24, writer->index[i].lines);
+        PutLE32(bytes + 28, writer->index[i].flags);
+        fwrite(bytes, 1, INDEX_ENTRY_SIZE, writer->fp);
+    }
+    PutLE64(bytes, writer->offset);
+    PutLE32(bytes + 8, writer->written);
+    memcpy(bytes + 12, TRACEZ_MAGIC, 4);
+    if (!writer->failed) {
+        fwrite(bytes, 1, FOOTER_SIZE, writer->fp);
+    }
+    if (writer->failed || ferror(writer->fp)) {
+        result = -1;
+    }
+    if (fclose(writer->fp) != 0) {
+        result = -1;
+    }
+    FreeWriter(writer);
+    return result;
+}
+
+
+/*
+ * Open a compressed trace for writing.
+ */
+FILE* OpenCompressedTrace(char* path, int threads)
+{
+    unsigned char header[HEADER_SIZE];
+    cookie_io_functions_t functions = {NULL, WriteTrace, NULL, CloseTrace};
+    TraceWriter* writer = calloc(1, sizeof(TraceWriter));
+    if (writer == NULL) {
+        return NULL;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    writer->fp = fopen(path, "wb");
+    if (writer->fp == NULL) {
+        free(writer);
+        return NULL;
+    }
+    memcpy(header, TRACEZ_MAGIC, 4);
+    PutLE32(header + 4, TRACEZ_VERSION);
+    PutLE32(header + 8, TRACEZ_BLOCK_SIZE);
+    fwrite(header, 1, HEADER_SIZE, writer->fp);
+    writer->offset = HEADER_SIZE;
+
+    //two blocks per worker keeps them busy while finished blocks wait to be written in order
+    writer->numSlots = 2 * threads;
+    writer->slots = calloc(writer->numSlots, sizeof(WriteBlock));
+    writer->current = malloc(TRACEZ_BLOCK_SIZE);
+    writer->threads = malloc(threads * sizeof(pthread_t));
+    int allocated = (writer->slots != NULL && writer->current != NULL && writer->threads != NULL);
+    for (int i = 0; allocated && i < writer->numSlots; i++) {
+        writer->slots[i].raw = malloc(TRACEZ_BLOCK_SIZE);
+        writer->slots[i].packed = malloc(TRACEZ_PACKED_BOUND(TRACEZ_BLOCK_SIZE));
+        allocated = (writer->slots[i].raw != NULL && writer->slots[i].packed != NULL);
+    }
+    if (!allocated) {
+        fclose(writer->fp);
+        remove(path);
+        FreeWriter(writer);
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->workReady, NULL);
+    pthread_cond_init(&writer->blockDone, NULL);
+    //carries on with fewer workers if not all of them start, but needs at least one
+    while (writer->numThreads < threads &&
+           pthread_create(&writer->threads[writer->numThreads], NULL, CompressWorker, writer) == 0) {
+        writer->numThreads++;
+    }
+
+    FILE* stream = (writer->numThreads > 0) ? fopencookie(writer, "w", functions) : NULL;
+    if (stream == NULL) {
+        StopWorkers(writer);
+        fclose(writer->fp);
+        remove(path);
+        FreeWriter(writer);
+        return NULL;
+    }
+    setvbuf(stream, NULL, _IOFBF, 1 << 16);
+    return stream;
+}
+
+
+//////////////// READER ///////////////////////////
+
+
+/*
+ * Open a compressed trace for reading.
+ */
+int OpenTraceReader(TraceReader* reader, char* path)
+{
+    unsigned char bytes[INDEX_ENTRY_SIZE];
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL) {
+        return -1;
+    }
+    if (fread(bytes, 1, HEADER_SIZE, reader->fp) != HEADER_SIZE || memcmp(bytes, TRACEZ_MAGIC, 4) != 0
+        || GetLE32(bytes + 4) != TRACEZ_VERSION || GetLE32(bytes + 8) > TRACEZ_BLOCK_SIZE) {
+        CloseTraceReader(reader);
+        return -1;
+    }
+    if (fseeko(reader->fp, -FOOTER_SIZE, SEEK_END) != 0 || fread(bytes, 1, FOOTER_SIZE, reader->fp) != FOOTER_SIZE
+        || memcmp(bytes + 12, TRACEZ_MAGIC, 4) != 0) {
+        CloseTraceReader(reader);
+        return -1;
+    }
+    unsigned long long indexOffset = GetLE64(bytes);
+    reader->numBlocks = GetLE32(bytes + 8);
+    reader->index = malloc((reader->numBlocks + 1) * sizeof(TraceBlockIndex));
+    reader->packed = malloc(TRACEZ_PACKED_BOUND(TRACEZ_BLOCK_SIZE));
+    if (reader->index == NULL || reader->packed == NULL || fseeko(reader->fp, indexOffset, SEEK_SET) != 0) {
+        CloseTraceReader(reader);
+        return -1;
+    }
+    for (unsigned int i = 0; i < reader->numBlocks; i++) {
+        if (fread(bytes, 1, INDEX_ENTRY_SIZE, reader->fp) != INDEX_ENTRY_SIZE) {
+            CloseTraceReader(reader);
+            return -1;
+        }
+        reader->index[i].offset = GetLE64(bytes);
+        reader->index[i].firstLine = GetLE64(bytes + 8);
+        reader->index[i].packedSize = GetLE32(bytes + 16);
+        reader->index[i].rawSize = GetLE32(bytes + 20);
+        reader->index[i].lines = GetLE32(bytes + 24);
+        reader->index[i].flags = GetLE32(bytes + 28);
+        if (reader->index[i].rawSize > TRACEZ_BLOCK_SIZE || reader->index[i].packedSize > TRACEZ_PACKED_BOUND(TRACEZ_BLOCK_SIZE)) {
+            CloseTraceReader(reader);
+            return -1;
+        }
+        reader->lines = reader->index[i].firstLine + reader->index[i].lines;
+    }
+    return 0;
+}
+
+
+/*
+ * Returns the block holding line, or -1 if the trace is shorter than that.
+ */
+int FindTraceBlock(TraceReader* reader, unsigned long long line)
+{
+    int low = 0, high = (int) reader->numBlocks - 1;
+    if (line >= reader->lines) {
+        return -1;
+    }
+    //finds the last block starting at or before line
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (reader->index[middle].firstLine <= line) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+
+/*
+ * Decompress block into raw.
+ */
+int ReadTraceBlock(TraceReader* reader, unsigned int block, char* raw)
+{
+    if (block >= reader->numBlocks) {
+        return -1;
+    }
+    TraceBlockIndex* entry = &reader->index[block];
+    if (fseeko(reader->fp, entry->offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    if (entry->flags & TRACEZ_STORED) {
+        return (fread(raw, 1, entry->rawSize, reader->fp) == entry->rawSize) ? (int) entry->rawSize : -1;
+    }
+    if (fread(reader->packed, 1, entry->packedSize, reader->fp) != entry->packedSize) {
+        return -1;
+    }
+    int size = DecompressBlock(reader->packed, entry->packedSize, (unsigned char*) raw, TRACEZ_BLOCK_SIZE);
+    return (size == (int) entry->rawSize) ? size : -1;
+}
+
+
+void CloseTraceReader(TraceReader* reader)
+{
+    if (reader->fp != NULL) {
+        fclose(reader->fp);
+    }
+    free(reader->index);
+    free(reader->packed);
+    reader->fp = NULL;
+    reader->index = NULL;
+    reader->packed = NULL;
+}
@@ -0,0 +1,90 @@
+/*
+ * tracez.h: Declares compressed trace files
+ *
+ * A compressed trace is a header, independently compressed blocks of whole trace lines, an
+ * index with one entry per block and a footer pointing at the index:
+ *
+ *   header  "LC4Z", version (4 bytes), block size (4 bytes)
+ *   blocks  ...
+ *   index   per block: file offset (8), first line (8), packed size (4), raw size (4),
+ *           lines (4), flags (4)
+ *   footer  index offset (8), number of blocks (4), "LC4Z"
+ *
+ * trace -compress N trace.z ... writes one; unlike plain traces it need not be named .txt.
+ * All numbers are little-endian. Lines are numbered from 0. trace only compresses unfiltered
+ * traces, where every cycle writes one line, so line N is the trace of cycle N.
+ */
+
+#ifndef TRACEZ_H
+#define TRACEZ_H
+
+#include <stdio.h>
+
+#define TRACEZ_MAGIC "LC4Z"
+#define TRACEZ_VERSION 1
+
+// Largest amount of trace text in one block
+#define TRACEZ_BLOCK_SIZE (1 << 20)
+
+// Space needed to compress a block of size bytes
+#define TRACEZ_PACKED_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Block flags
+#define TRACEZ_STORED 1
+
+typedef struct {
+    unsigned long long offset;
+    unsigned long long firstLine;
+    unsigned int packedSize;
+    unsigned int rawSize;
+    unsigned int lines;
+    unsigned int flags;
+} TraceBlockIndex;
+
+typedef struct {
+    FILE* fp;
+    TraceBlockIndex* index;
+    unsigned int numBlocks;
+    unsigned long long lines;
+    unsigned char* packed;
+} TraceReader;
+
+
+/*
+ * Open a compressed trace for writing, compressed on the given number of worker threads.
+ * Returns a stream to pass to the simulator in place of a text file, or NULL on error.
+ * The index is written when the stream is closed with fclose, which fails if it could not be.
+ */
+FILE* OpenCompressedTrace(char* path, int threads);
+
+
+/*
+ * Open a compressed trace for reading. Returns -1 if it is not a valid compressed trace.
+ */
+int OpenTraceReader(TraceReader* reader, char* path);
+
+
+/*
+ * Returns the block holding line, or -1 if the trace is shorter than that.
+ */
+int FindTraceBlock(TraceReader* reader, unsigned long long line);
+
+
+/*
+ * Decompress block into raw, which must hold TRACEZ_BLOCK_SIZE bytes. Returns its size, or -1 on a corrupt block.
+ */
+int ReadTraceBlock(TraceReader* reader, unsigned int block, char* raw);
+
+
+void CloseTraceReader(TraceReader* reader);
+
+
+/*
+ * The block codec, a byte oriented LZ77 in the style of LZ4. CompressBlock returns the packed
+ * size, dst must hold TRACEZ_PACKED_BOUND(size) bytes. DecompressBlock returns the unpacked
+ * size or -1 if src is corrupt or does not fit in capacity.
+ */
+int CompressBlock(const unsigned char* src, int size, unsigned char* dst);
+int DecompressBlock(const unsigned char* src, int size, unsigned char* dst, int capacity);
+
+#endif